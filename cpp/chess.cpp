@@ -311,8 +311,7 @@ std::vector<Move> Moves(int player, const Position &position) {
                     Move m;
                     m.from = {i, j};
                     m.to = {move.toRow, move.toCol};
-                    // m.board = new_board.board;
-                    memcpy(m.board, new_board.board, sizeof(new_board.board));
+                    m.delta.set_diff(position.board, new_board.board, BOARD_WIDTH*BOARD_HEIGHT);
                     out.push_back(m);
                 }
             }
@@ -0,0 +1,385 @@
+#pragma once
+
+/*
+ * Depth-First Proof-Number Search
+ *
+ * Solves small games outright. df-pn only proves yes/no questions, so a position is
+ * solved with two of them, each asked for the player to move at the root (the attacker):
+ *   WIN:      can the attacker force a win?
+ *   NOT_LOSE: can the attacker force at least a draw?
+ * Nodes where the attacker moves are OR nodes, the others AND nodes. A node's
+ * (pn, dn) is the number of leaves still to prove / disprove its question.
+ *
+ * The table is bounded: buckets of 4 entries keyed by Zobrist hash, question and node
+ * kind, replacing the entry with the least work (nodes searched under it). Locks are
+ * striped over the buckets. Threads all search from the root; a node counts the threads
+ * inside it, and siblings look that much worse to the others (like a virtual loss).
+ *
+ * A repetition on the path counts as a draw, as in the searchers. Like most df-pn,
+ * a result stored while depending on one can be off in rare graph history cases.
+ *
+ * Every position settled by the two searches goes into a results file, which
+ * SolvedTable loads so play can answer them without searching.
+ *
+ * Usage:
+ *   DFPN s(max_pty, n, m, nt, lua_path, 256);  // 256MB table
+ *   PosType r = s.solve(pos);
+ *   s.write(path);
+ */
+
+#include "lua_interface.hpp"
+#include "pool.hpp"
+#include "pos_type_cache.hpp"
+#include "util.hpp"
+#include "zobrist.hpp"
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+
+struct DFPN {
+	static constexpr uint32_t INF = 1u<<30;
+	static constexpr int MAX_PLY = 256;
+	// added to a child's number per thread already searching it
+	static constexpr uint32_t VIRTUAL = 4;
+
+	enum Mode { WIN, NOT_LOSE };
+
+	struct Entry {
+		uint64_t key;
+		uint32_t pn, dn;
+		uint32_t work;
+		// mode*2 + or node, and threads searching it
+		unsigned char kind, busy;
+	};
+
+	struct PN {
+		uint32_t pn, dn;
+	};
+
+	struct Table {
+		static constexpr int BUCKET = 4, LOCKS = 1024;
+
+		std::unique_ptr<Entry[]> table;
+		uint64_t mask;
+		std::array<std::mutex, LOCKS> locks;
+
+		Table(int mb) {
+			uint64_t nb=1;
+			while (2*nb*BUCKET*sizeof(Entry) <= (uint64_t(mb)<<20)) nb*=2;
+
+			table.reset(new Entry[nb*BUCKET]());
+			mask=nb-1;
+		}
+
+		// with the bucket's lock held
+		Entry* find(uint64_t key, int kind) {
+			Entry* b = &table[(key&mask)*BUCKET];
+			for (int i=0; i<BUCKET; i++) {
+				if (b[i].key==key && b[i].kind==kind) return &b[i];
+			}
+
+			return nullptr;
+		}
+
+		Entry* find_or_add(uint64_t key, int kind) {
+			if (Entry* e = find(key, kind)) return e;
+
+			Entry* b = &table[(key&mask)*BUCKET];
+			Entry* victim=nullptr;
+			for (int i=0; i<BUCKET; i++) {
+				if (b[i].busy) continue;
+				if (!victim || b[i].work<victim->work) victim=&b[i];
+			}
+
+			if (!victim) return nullptr; // every entry in use by some thread, not stored
+			*victim = Entry {.key=key, .pn=1, .dn=1, .work=0, .kind=(unsigned char)kind, .busy=0};
+			return victim;
+		}
+
+		std::mutex& lock(uint64_t key) {
+			return locks[(key&mask)%LOCKS];
+		}
+
+		bool probe(uint64_t key, int kind, PN& out, int& busy) {
+			std::scoped_lock l(lock(key));
+			Entry* e = find(key, kind);
+			if (!e) return false;
+
+			out = {e->pn, e->dn}, busy = e->busy;
+			return true;
+		}
+
+		void store(uint64_t key, int kind, PN v, uint32_t work) {
+			std::scoped_lock l(lock(key));
+			if (Entry* e = find_or_add(key, kind)) {
+				e->pn=v.pn, e->dn=v.dn;
+				e->work = std::min<uint64_t>(uint64_t(e->work)+work, ~uint32_t(0));
+			}
+		}
+
+		// threads inside the node, shown to siblings' selection
+		void enter(uint64_t key, int kind) {
+			std::scoped_lock l(lock(key));
+			if (Entry* e = find_or_add(key, kind)) e->busy++;
+		}
+
+		void leave(uint64_t key, int kind) {
+			std::scoped_lock l(lock(key));
+			Entry* e = find(key, kind);
+			if (e && e->busy) e->busy--;
+		}
+	};
+
+	// per thread: lua state, path hashes and move lists by ply
+	struct Thread {
+		int lua_i;
+		vec<uint64_t> path;
+		vec<vec<Move>> moves;
+		vec<vec<uint64_t>> child_hash;
+
+		Thread(int lua_i_): lua_i(lua_i_), path(MAX_PLY+1), moves(MAX_PLY+1), child_hash(MAX_PLY+1) {}
+	};
+
+	int n, m, nt;
+	Zobrist zob;
+	vec<LuaInterface> interfaces;
+	vec<Thread> threads;
+	Pool pool;
+	Table tt;
+	// get_pos_type results by position hash, shared by the threads
+	PosTypeCache types;
+
+	std::atomic<bool> stop=false;
+	std::atomic<uint64_t> nodes=0;
+	// gives up past this many nodes per question, 0 for no limit
+	uint64_t max_nodes=0;
+
+	DFPN(int max_pty, int n_, int m_, int nt_, std::string const& lua_path, int mb=256, int types_mb=16):
+		n(n_), m(m_), nt(nt_), zob(max_pty, n_*m_), pool(nt_), tt(mb), types(types_mb) {
+		for (int i=0; i<=nt; i++) {
+			interfaces.emplace_back(lua_path);
+			threads.emplace_back(i);
+		}
+	}
+
+	// salts the hash by question and node kind, so they don't share entries
+	static uint64_t key(uint64_t h, int kind) {
+		return h ^ (uint64_t(kind+1)*0x9e3779b97f4a7c15ull);
+	}
+
+	static uint32_t add(uint32_t a, uint32_t b) {
+		return std::min<uint64_t>(uint64_t(a)+b, INF);
+	}
+
+	// (pn, dn) of a finished game, pty for the player to move
+	static PN leaf(PosType pty, int kind) {
+		bool or_node = kind&1;
+		if (!or_node) pty = pty==PosType::Win ? PosType::Loss : pty==PosType::Loss ? PosType::Win : pty;
+
+		bool yes = kind>>1==WIN ? pty==PosType::Win : pty!=PosType::Loss;
+		return yes ? PN {0, INF} : PN {INF, 0};
+	}
+
+	bool on_path(Thread& th, int ply, uint64_t h) {
+		for (int x=ply; x>=0; x--) if (th.path[x]==h) return true;
+		return false;
+	}
+
+	// the child's numbers, from the table or by asking lua whether the game is over
+	PN child(Thread& th, int ply, Position const& pos, int k, int ckind, int& busy) {
+		uint64_t h = th.child_hash[ply][k];
+		busy=0;
+		if (on_path(th, ply, h)) return leaf(PosType::Draw, ckind);
+
+		PN v;
+		if (tt.probe(key(h, ckind), ckind, v, busy)) return v;
+
+		PosType pty;
+		if (!types.probe(h, pty)) {
+			pty = interfaces[th.lua_i].get_pos_type(after_move(pos, th.moves[ply][k]));
+			types.store(h, pty);
+		}
+
+		v = pty==PosType::Other ? PN {1, 1} : leaf(pty, ckind);
+		tt.store(key(h, ckind), ckind, v, 0);
+		return v;
+	}
+
+	// multiple iterative deepening: searches pos until its numbers reach a threshold
+	PN mid(Thread& th, int ply, Position const& pos, uint64_t h, uint32_t thpn, uint32_t thdn, int kind) {
+		bool or_node = kind&1;
+		int ckind = kind^1;
+
+		if (ply>=MAX_PLY) return leaf(PosType::Draw, kind);
+		th.path[ply] = h;
+
+		auto& mv = th.moves[ply];
+		mv.clear();
+		interfaces[th.lua_i].valid_moves(mv, pos);
+
+		auto& ch = th.child_hash[ply];
+		ch.resize(mv.size());
+		for (int k=0; k<mv.size(); k++) ch[k] = zob.update(h^zob.player, pos.board, mv[k].delta);
+
+		uint64_t nodes0 = nodes.fetch_add(1, std::memory_order_relaxed);
+		tt.enter(key(h, kind), kind);
+
+		PN v {INF, 0};
+		if (mv.empty()) v = leaf(PosType::Draw, kind);
+
+		// the child searched last and what it returned, used over the table: its entry
+		// may have been replaced, or never stored, and reading {1, 1} again would pick
+		// it again and again
+		int last=-1;
+		PN last_v;
+
+		while (!mv.empty()) {
+			// OR: pn is the easiest child's, dn all of theirs. AND the other way round
+			v = or_node ? PN {INF, 0} : PN {0, INF};
+			int best=-1;
+			uint32_t best_n=INF+1, second=INF, best_pn=0, best_dn=0;
+			for (int k=0; k<mv.size(); k++) {
+				int busy=0;
+				PN c = k==last ? last_v : child(th, ply, pos, k, ckind, busy);
+
+				uint32_t num = or_node ? c.pn : c.dn;
+				if (or_node) v.pn = std::min(v.pn, c.pn), v.dn = add(v.dn, c.dn);
+				else v.pn = add(v.pn, c.pn), v.dn = std::min(v.dn, c.dn);
+
+				uint32_t sel = num ? add(num, VIRTUAL*busy) : 0;
+				if (sel<best_n) second=best_n, best_n=sel, best=k, best_pn=c.pn, best_dn=c.dn;
+				else if (sel<second) second=sel;
+			}
+
+			second = std::min(second, INF);
+			if (v.pn>=thpn || v.dn>=thdn || stop.load(std::memory_order_relaxed)) break;
+			if (max_nodes && nodes.load(std::memory_order_relaxed)>=max_nodes) stop=true;
+
+			uint32_t cthpn, cthdn;
+			if (or_node) {
+				cthpn = std::min(thpn, add(second, 1));
+				cthdn = std::min<uint64_t>(uint64_t(thdn) - v.dn + best_dn, INF);
+			} else {
+				cthdn = std::min(thdn, add(second, 1));
+				cthpn = std::min<uint64_t>(uint64_t(thpn) - v.pn + best_pn, INF);
+			}
+
+			Position c = after_move(pos, mv[best]);
+			last_v = mid(th, ply+1, c, ch[best], cthpn, cthdn, ckind);
+			last = best;
+		}
+
+		tt.leave(key(h, kind), kind);
+		tt.store(key(h, kind), kind, v, nodes.load(std::memory_order_relaxed)-nodes0);
+		return v;
+	}
+
+	// one question for the player to move at pos, all threads on it
+	PN prove(Position const& pos, Mode mode) {
+		int kind = mode*2+1;
+		uint64_t h = zob.hash(pos);
+		stop=false, nodes=0;
+
+		PN out {1, 1};
+		std::mutex out_mut;
+		pool.launch_all([&](int ti) {
+			Thread& th = threads[ti==nt ? 0 : ti+1];
+			PN v = mid(th, 0, pos, h, INF, INF, kind);
+
+			std::scoped_lock l(out_mut);
+			if (v.pn==0 || v.dn==0) {
+				out=v;
+				stop=true;
+			}
+		}, nt+1);
+
+		return out;
+	}
+
+	// the game's value for the player to move, Other if out of nodes
+	PosType solve(Position const& pos) {
+		PN win = prove(pos, WIN);
+		if (win.pn==0) return PosType::Win;
+		if (win.pn!=INF) return PosType::Other;
+
+		PN not_lose = prove(pos, NOT_LOSE);
+		if (not_lose.pn==0) return PosType::Draw;
+		if (not_lose.dn==0) return PosType::Loss;
+		return PosType::Other;
+	}
+
+	// every position the table settles: "dfpn <n> <m> <max_pty>", then "<hash> <w|l|d>"
+	// for the player to move. answers to either question about either player combine
+	void write(std::string const& path, int max_pty) {
+		enum { W=1, L=2, NOT_W=4, NOT_L=8 };
+		::map<uint64_t, int> flags;
+
+		for (uint64_t i=0; i<(tt.mask+1)*Table::BUCKET; i++) {
+			Entry const& e = tt.table[i];
+			// unsettled, or never used: a stored entry has at most one of pn, dn at 0
+			if ((e.pn!=0) == (e.dn!=0)) continue;
+
+			bool or_node = e.kind&1, proven = e.pn==0;
+			int f;
+			// the question holds / fails for the attacker, turned around for the player to move
+			if (e.kind>>1==WIN) f = proven ? (or_node ? W : L) : (or_node ? NOT_W : NOT_L);
+			else f = proven ? (or_node ? NOT_L : NOT_W) : (or_node ? L : W);
+
+			flags[key(e.key, e.kind)] |= f; // key() undoes itself
+		}
+
+		std::ofstream out(path);
+		out<<"dfpn "<<n<<" "<<m<<" "<<max_pty<<"\n";
+		for (auto [h, f]: flags) {
+			char c = f&W ? 'w' : f&L ? 'l' : (f&NOT_W && f&NOT_L) ? 'd' : 0;
+			if (c) out<<std::hex<<h<<std::dec<<" "<<c<<"\n";
+		}
+	}
+};
+
+// results written by DFPN::write, for play
+struct SolvedTable {
+	::map<uint64_t, PosType> v;
+	std::unique_ptr<Zobrist> zob;
+	int nm=0;
+
+	// false if the file is missing or for another board
+	bool load(std::string const& path, int n, int m, int max_pty) {
+		std::ifstream in(path);
+		std::string magic;
+		int fn, fm, fpty;
+		if (!(in>>magic>>fn>>fm>>fpty) || magic!="dfpn" || fn!=n || fm!=m || fpty!=max_pty) return false;
+
+		uint64_t h;
+		char c;
+		while (in>>std::hex>>h>>std::dec>>c) {
+			v[h] = c=='w' ? PosType::Win : c=='l' ? PosType::Loss : PosType::Draw;
+		}
+
+		zob = std::make_unique<Zobrist>(max_pty, n*m);
+		nm = n*m;
+		return true;
+	}
+
+	PosType probe(Position const& pos) const {
+		if (!zob) return PosType::Other;
+		auto it = v.find(zob->hash(pos));
+		return it==v.end() ? PosType::Other : it->second;
+	}
+
+	// a move keeping pos's solved value, -1 if pos isn't solved or no such move is known
+	int best_move(Position const& pos, vec<Move> const& moves) const {
+		PosType val = probe(pos);
+		if (val==PosType::Other) return -1;
+
+		// what the child has to be for the opponent
+		PosType want = val==PosType::Win ? PosType::Loss : val==PosType::Draw ? PosType::Draw : PosType::Win;
+		for (int i=0; i<moves.size(); i++) {
+			if (probe(after_move(pos, moves[i]))==want) return i;
+		}
+
+		return -1;
+	}
+};
@@ -14,14 +14,24 @@ void LuaInterface::check(int r) {
 }
 
 struct LuaBoard {
+	BoardPool* pool;
 	int n,m;
 	unsigned char board[MAX_BOARD_SIZE];
 };
 
+// methods are bound to their board (upvalue 1) so board.get(i, j) works, for
+// board:get(i, j) the board table passed first is skipped
+static int first_arg(lua_State* L) {
+	return lua_type(L, 1)==LUA_TTABLE ? 2 : 1;
+}
+
+int board_clone(lua_State* L);
+
 int board_get(lua_State* L) { 
-	LuaBoard* board = static_cast<LuaBoard*>(luaL_checkudata(L, lua_upvalueindex(1), "board"));
-	int i = luaL_checkinteger(L, 1)-1;
-	int j = luaL_checkinteger(L, 2)-1;
+	LuaBoard* board = static_cast<LuaBoard*>(lua_touserdata(L, lua_upvalueindex(1)));
+	int a = first_arg(L);
+	int i = luaL_checkinteger(L, a)-1;
+	int j = luaL_checkinteger(L, a+1)-1;
 
 	if (j<0 || j>=board->m || i<0 || i>=board->n) lua_pushnil(L);
 	else lua_pushinteger(L, board->board[i*board->m + j]);
@@ -29,10 +39,11 @@ int board_get(lua_State* L) {
 }
 
 int board_set(lua_State* L) { 
-	LuaBoard* board = static_cast<LuaBoard*>(luaL_checkudata(L, lua_upvalueindex(1), "board"));
-	int i = luaL_checkinteger(L, 1)-1;
-	int j = luaL_checkinteger(L, 2)-1;
-	int v = luaL_checkinteger(L, 3);
+	LuaBoard* board = static_cast<LuaBoard*>(lua_touserdata(L, lua_upvalueindex(1)));
+	int a = first_arg(L);
+	int i = luaL_checkinteger(L, a)-1;
+	int j = luaL_checkinteger(L, a+1)-1;
+	int v = luaL_checkinteger(L, a+2);
 
 	if (j<0 || j>=board->m || i<0 || i>=board->n) {
 		return luaL_error(L, "index %i, %i out of bounds of %i x %i board", i,j, board->n, board->m);
@@ -43,41 +54,156 @@ int board_set(lua_State* L) {
 	return 0;
 }
 
-int board_clone(lua_State* L);
+// takes the next slot of the pool, a new board only once the pool runs out. a board is
+// a table of methods bound to the LuaBoard in its inner field, plain fields so they're
+// found without a metamethod call
+void push_board(lua_State* L, BoardPool& pool, unsigned char const* b, int n, int m) {
+	LuaBoard* board;
+	lua_rawgeti(L, LUA_REGISTRYINDEX, pool.ref); // stack: pool
 
-void push_board(lua_State* L, unsigned char const* b, int n, int m) {
-	lua_createtable(L, 0, 3);
+	if (pool.used<pool.boards.size()) {
+		lua_rawgeti(L, -1, pool.used+1); // stack: pool, board
+		board = static_cast<LuaBoard*>(pool.boards[pool.used]);
+	} else {
+		lua_createtable(L, 0, 4);
+		board = static_cast<LuaBoard*>(lua_newuserdatauv(L, sizeof(LuaBoard), 0));
+		board->pool=&pool;
+		luaL_setmetatable(L, "board"); // stack: pool, board, inner
+
+		std::pair<char const*, lua_CFunction> methods[] = {{"get", board_get}, {"set", board_set}, {"clone", board_clone}};
+		for (auto [name, f]: methods) {
+			lua_pushvalue(L, -1);
+			lua_pushcclosure(L, f, 1);
+			lua_setfield(L, -3, name);
+		}
+
+		lua_setfield(L, -2, "inner"); // stack: pool, board
+		lua_pushvalue(L, -1);
+		lua_rawseti(L, -3, pool.boards.size()+1);
+		pool.boards.push_back(board);
+	}
 
-	auto board = static_cast<LuaBoard*>(lua_newuserdata(L, sizeof(LuaBoard)));
+	lua_remove(L, -2); // stack: board
+	pool.used++;
 	board->n=n, board->m=m;
 	std::copy(b,b+n*m, board->board);
-	luaL_setmetatable(L, "board");
+}
 
-	lua_pushvalue(L, -1);
-	lua_pushcclosure(L, board_get, 1);
-	lua_setfield(L, -3, "get");
+int board_clone(lua_State* L) {
+	LuaBoard* old = static_cast<LuaBoard*>(lua_touserdata(L, lua_upvalueindex(1)));
+	push_board(L, *old->pool, old->board, old->n, old->m);
+	return 1;
+}
 
-	lua_pushvalue(L, -1);
-	lua_pushcclosure(L, board_set, 1);
-	lua_setfield(L, -3, "set");
+// gives back the boards taken after it was made when it goes out of scope
+struct PoolMark {
+	BoardPool& pool;
+	int used;
 
-	lua_pushvalue(L, -1);
-	lua_pushcclosure(L, board_clone, 1);
-	lua_setfield(L, -3, "clone");
+	PoolMark(BoardPool& pool_): pool(pool_), used(pool_.used) {}
+	~PoolMark() {
+		pool.used = used;
+	}
+};
+
+// applies the table at idx of {i, j, piece} changes, in order, to after.
+// the error if one is malformed
+static char const* read_changes(lua_State* L, int idx, Position& after, int n, int m) {
+	if (!lua_istable(L, idx)) return "changes is not a table";
 
-	lua_setfield(L, -2, "inner");
+	int k = lua_rawlen(L, idx);
+	for (int c=1; c<=k; c++) {
+		lua_rawgeti(L, idx, c); // stack: ..., change
+		if (lua_rawlen(L, -1)!=3) {
+			lua_pop(L, 1);
+			return "expected {i, j, piece} for a change";
+		}
+
+		int x[3];
+		for (int y=0; y<3; y++) {
+			lua_rawgeti(L, -1, y+1);
+			x[y] = lua_tointeger(L, -1);
+			lua_pop(L, 1);
+		}
+
+		lua_pop(L, 1); // stack: ...
+		if (x[0]<1 || x[0]>n || x[1]<1 || x[1]>m) return "change out of bounds of the board";
+		after.board[(x[0]-1)*m + x[1]-1] = x[2];
+	}
+
+	return nullptr;
 }
 
-int board_clone(lua_State* L) {
-	LuaBoard* old = static_cast<LuaBoard*>(luaL_checkudata(L, lua_upvalueindex(1), "board"));
-	push_board(L, old->board, old->n, old->m);
-	return 1;
+// capture = the piece taken (or true if it doesn't matter), promotion, check,
+// from the values at those stack indices
+static void read_tags(lua_State* L, Move& move, int capture, int promotion, int check) {
+	move.tags=0, move.captured=0;
+	if (lua_isnumber(L, capture)) move.captured = lua_tointeger(L, capture);
+	if (lua_toboolean(L, capture) && !(lua_isnumber(L, capture) && !move.captured)) move.tags|=TAG_CAPTURE;
+	if (lua_toboolean(L, promotion)) move.tags|=TAG_PROMOTION;
+	if (lua_toboolean(L, check)) move.tags|=TAG_CHECK;
+}
+
+// emit(fi, fj, ti, tj [, after [, capture, promotion, check]]), handed to EmitMoves.
+// after is nil for the piece on from moving to to, a piece for it turning into that
+// on to, a {i, j, piece} changes table, or a board. errors are lua errors, this runs
+// inside the script
+int move_emit(lua_State* L) {
+	auto& sink = *static_cast<MoveSink*>(lua_touserdata(L, lua_upvalueindex(1)));
+	int n=sink.n, m=sink.m;
+
+	int c[4];
+	for (int k=0; k<4; k++) c[k] = luaL_checkinteger(L, k+1)-1;
+	if (c[0]<0 || c[0]>=n || c[1]<0 || c[1]>=m || c[2]<0 || c[2]>=n || c[3]<0 || c[3]>=m) {
+		return luaL_error(L, "move %d, %d -> %d, %d out of bounds of %d x %d board", c[0]+1, c[1]+1, c[2]+1, c[3]+1, n, m);
+	}
+
+	Position after = *sink.pos;
+	int from = c[0]*m + c[1], to = c[2]*m + c[3];
+	int piece = after.board[from];
+
+	switch (lua_type(L, 5)) {
+		case LUA_TNUMBER:
+			piece = lua_tointeger(L, 5);
+			[[fallthrough]];
+		case LUA_TNONE:
+		case LUA_TNIL:
+			after.board[from]=0;
+			after.board[to]=piece;
+			break;
+		case LUA_TTABLE: {
+			lua_getfield(L, 5, "inner");
+			auto b = static_cast<LuaBoard*>(luaL_testudata(L, -1, "board"));
+			lua_pop(L, 1);
+
+			if (b) std::copy(b->board, b->board + n*m, after.board);
+			else if (char const* err = read_changes(L, 5, after, n, m)) return luaL_error(L, "%s", err);
+			break;
+		}
+		default:
+			return luaL_error(L, "emit: expected nil, a piece, changes or a board after the coordinates");
+	}
+
+	Move& move = sink.out->emplace_back();
+	move.from = {(unsigned char)c[0], (unsigned char)c[1]};
+	move.to = {(unsigned char)c[2], (unsigned char)c[3]};
+	move.delta.set_diff(sink.pos->board, after.board, n*m);
+
+	if (sink.tags) read_tags(L, move, 6, 7, 8);
+	else derive_tags(*sink.pos, move, n, m);
+	return 0;
 }
 
 LuaInterface::LuaInterface(std::string const& path) {
 	L = luaL_newstate();
 	luaL_openlibs(L);
+
 	luaL_newmetatable(L, "board");
+	lua_pop(L, 1);
+
+	pool = std::make_unique<BoardPool>();
+	lua_newtable(L);
+	pool->ref = luaL_ref(L, LUA_REGISTRYINDEX);
 
 	lua_getglobal(L, "io");
 	lua_pushstring(L, "stdout");
@@ -99,6 +225,36 @@ LuaInterface::LuaInterface(std::string const& path) {
 	n = lua_tointeger(L, -2);
 	m = lua_tointeger(L, -1);
 	lua_pop(L, 2);
+
+	lua_getglobal(L, "MovesIter");
+	has_moves_iter = lua_isfunction(L, -1);
+	lua_pop(L, 1);
+
+	lua_getglobal(L, "MOVE_TAGS");
+	has_tags = lua_toboolean(L, -1);
+	lua_pop(L, 1);
+
+	lua_getglobal(L, "EmitMoves");
+	has_emit = lua_isfunction(L, -1);
+	lua_pop(L, 1);
+
+	lua_getglobal(L, "MovesWithStatus");
+	has_status = lua_isfunction(L, -1);
+	lua_pop(L, 1);
+
+	lua_getglobal(L, "NULL_MOVE");
+	null_move_ok = lua_toboolean(L, -1);
+	lua_pop(L, 1);
+
+	lua_getglobal(L, "PROBCUT");
+	probcut_ok = lua_toboolean(L, -1);
+	lua_pop(L, 1);
+
+	sink = std::make_unique<MoveSink>();
+	sink->n=n, sink->m=m, sink->tags=has_tags;
+	lua_pushlightuserdata(L, sink.get());
+	lua_pushcclosure(L, move_emit, 1);
+	sink->ref = luaL_ref(L, LUA_REGISTRYINDEX);
 }
 
 LuaInterface::~LuaInterface() {
@@ -107,40 +263,35 @@ LuaInterface::~LuaInterface() {
 
 void LuaInterface::push_position(Position const& pos) {
 	lua_pushinteger(L, pos.next_player+1); // stack: moves, player
-	push_board(L, pos.board, n, m);
+	push_board(L, *pool, pos.board, n, m);
+}
+
+// "win", "loss", "draw" or nil on top of the stack, leaving it there
+static PosType read_pos_type(lua_State* L) {
+	if (lua_isnil(L, -1)) return PosType::Other;
+
+	char const* ret_str = luaL_checkstring(L, -1); // stack: result
+	if (!ret_str) throw LuaException("Position type not a string");
+
+	if (ret_str[0]=='w') return PosType::Win;
+	else if (ret_str[0]=='d') return PosType::Draw;
+	else if (ret_str[0]=='l') return PosType::Loss;
+	else throw LuaException("Unrecognized position outcome");
 }
 
 PosType LuaInterface::get_pos_type(Position const& position) {
+	PoolMark mark(*pool);
 	lua_getglobal(L, "Type"); // stack: moves()
 	push_position(position);
 	check(lua_pcall(L, 2, 1, 0)); // stack: result
 	
-	PosType ret;
-	if (lua_isnil(L, -1)) {
-		ret=PosType::Other;
-	} else {
-		char const* ret_str = luaL_checkstring(L, -1); // stack: result
-		if (!ret_str) throw LuaException("Position type not a string");
-
-		if (ret_str[0]=='w') ret=PosType::Win;
-		else if (ret_str[0]=='d') ret=PosType::Draw;
-		else if (ret_str[0]=='l') ret=PosType::Loss;
-		else throw LuaException("Unrecognized position outcome");
-	}
-	
+	PosType ret = read_pos_type(L);
 	lua_pop(L, 1);
 	return ret;
 }
 
-void LuaInterface::valid_moves(vec<Move>& out, Position const& position) {
-	lua_getglobal(L, "Moves"); // stack: moves()
-	push_position(position);
-	
-	//moves, player, board, piece
-	check(lua_pcall(L, 2, 1, 0)); // stack: result
-	
-	if (!lua_istable(L, -1)) throw LuaException("Return is not a table");
-	
+// reads the move table on top of the stack, leaving it there
+void LuaInterface::read_move(Move& move, Position const& position) {
 	auto get_coord = [L=L]() {
 		Coord c;
 		if (lua_rawlen(L, -1)!=2) throw LuaException("expected 2 numbers for coord");
@@ -155,34 +306,167 @@ void LuaInterface::valid_moves(vec<Move>& out, Position const& position) {
 
 		return c;
 	};
+
+	lua_getfield(L, -1, "from"); // stack: move, from_coord
+	move.from = get_coord();
+	lua_pop(L, 1); // stack: move
+
+	lua_getfield(L, -1, "to"); // stack: move, to_coord
+	move.to = get_coord();
+	lua_pop(L, 1); // stack: move
+
+	// the squares changed, or the whole board after
+	Position after = position;
+	if (lua_getfield(L, -1, "changes")!=LUA_TNIL) { // stack: move, changes
+		if (char const* err = read_changes(L, lua_gettop(L), after, n, m)) throw LuaException(err);
+		lua_pop(L, 1); // stack: move
+	} else {
+		lua_pop(L, 1);
+		lua_getfield(L, -1, "board");
+		lua_getfield(L, -1, "inner");
+
+		auto b = static_cast<LuaBoard*>(luaL_checkudata(L, -1, "board"));
+		std::copy(b->board, b->board + n*m, after.board);
+
+		lua_pop(L, 2); // pop udata, board
+	}
+
+	move.delta.set_diff(position.board, after.board, n*m);
+
+	if (!has_tags) {
+		derive_tags(position, move, n, m);
+		return;
+	}
+
+	lua_getfield(L, -1, "capture"); // stack: move, capture
+	lua_getfield(L, -2, "promotion");
+	lua_getfield(L, -3, "check");
+	int top = lua_gettop(L);
+	read_tags(L, move, top-2, top-1, top);
+	lua_pop(L, 3); // stack: move
+}
+
+void LuaInterface::valid_moves(vec<Move>& out, Position const& position) {
+	if (has_emit) {
+		PoolMark mark(*pool);
+		MoveSink saved = *sink;
+		sink->out=&out, sink->pos=&position;
+
+		lua_getglobal(L, "EmitMoves"); // stack: EmitMoves()
+		push_position(position);
+		lua_rawgeti(L, LUA_REGISTRYINDEX, sink->ref); // stack: EmitMoves(), player, board, emit
+		int r = lua_pcall(L, 3, 0, 0);
+
+		*sink = saved;
+		check(r);
+		return;
+	}
+
+	if (has_moves_iter) {
+		auto it = moves_iter(position);
+		for (Move* move = &out.emplace_back(); it.next(*move); move = &out.emplace_back());
+		out.pop_back();
+		return;
+	}
+
+	PoolMark mark(*pool);
+	lua_getglobal(L, "Moves"); // stack: moves()
+	push_position(position);
+	
+	//moves, player, board, piece
+	check(lua_pcall(L, 2, 1, 0)); // stack: result
+	
+	if (!lua_istable(L, -1)) throw LuaException("Return is not a table");
 	
 	int numMoves = lua_rawlen(L, -1); // stack: result
 	out.reserve(numMoves);
 	
 	for (int i = 1; i <= numMoves; i++) {
 		lua_rawgeti(L, -1, i); // stack: result, move
-		Move& move = out.emplace_back();
-		
-		lua_getfield(L, -1, "from"); // stack: result, move, operation, from_coord
-		move.from = get_coord(); // stack: result, move, operation, from_coord
-		lua_pop(L, 1); // stack: result, move, operation
-		
-		lua_getfield(L, -1, "to"); // stack: result, move, operation, from_coord
-		move.to = get_coord(); // stack: result, move, operation, to_coord
-		lua_pop(L, 1); // stack: result, move, operation
-			
-		lua_getfield(L, -1, "board");
-		lua_getfield(L, -1, "inner");
-
-		auto b = static_cast<LuaBoard*>(luaL_checkudata(L, -1, "board"));
-		std::copy(b->board, b->board + n*m, move.board);
-			
-		lua_pop(L, 3); //pop udata, board, move
+		read_move(out.emplace_back(), position);
+		lua_pop(L, 1); // stack: result
 	}
 	
 	lua_pop(L, 1); // stack: result
 }
 
+void LuaInterface::moves_with_status(vec<Move>& out, vec<PosType>& status, Position const& position) {
+	status.clear();
+	if (!has_status) {
+		int first = out.size();
+		valid_moves(out, position);
+		for (int i=first; i<out.size(); i++) status.push_back(get_pos_type(after_move(position, out[i])));
+		return;
+	}
+
+	PoolMark mark(*pool);
+	lua_getglobal(L, "MovesWithStatus"); // stack: MovesWithStatus()
+	push_position(position);
+	check(lua_pcall(L, 2, 1, 0)); // stack: result
+
+	if (!lua_istable(L, -1)) throw LuaException("Return is not a table");
+
+	int numMoves = lua_rawlen(L, -1);
+	out.reserve(out.size() + numMoves);
+	status.reserve(numMoves);
+
+	for (int i = 1; i <= numMoves; i++) {
+		lua_rawgeti(L, -1, i); // stack: result, move
+		read_move(out.emplace_back(), position);
+
+		lua_getfield(L, -1, "status"); // stack: result, move, status
+		status.push_back(read_pos_type(L));
+		lua_pop(L, 2); // stack: result
+	}
+
+	lua_pop(L, 1);
+}
+
+MoveIter LuaInterface::moves_iter(Position const& position) {
+	// the coroutine may hold on to position and its clones until it's destroyed
+	PoolMark mark(*pool);
+	lua_getglobal(L, "MovesIter"); // stack: MovesIter()
+	push_position(position);
+	check(lua_pcall(L, 2, 1, 0)); // stack: iterator
+
+	if (!lua_isfunction(L, -1)) throw LuaException("MovesIter didn't return a function");
+	int ref = luaL_ref(L, LUA_REGISTRYINDEX); // stack: (empty)
+
+	pool->iters.push_back({mark.used, false});
+	mark.used = pool->used;
+	return MoveIter(this, ref, position, pool->iters.size()-1);
+}
+
+bool MoveIter::next(Move& out) {
+	lua_State* L = lua->L;
+	lua_rawgeti(L, LUA_REGISTRYINDEX, ref); // stack: iterator
+	lua->check(lua_pcall(L, 0, 1, 0)); // stack: move or nil
+
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+		return false;
+	}
+
+	// the yielded value, and whatever read_move had pushed, come off the stack on an error
+	int top = lua_gettop(L);
+	try {
+		if (!lua_istable(L, -1)) throw LuaException("MovesIter yielded something other than a move");
+		lua->read_move(out, pos);
+	} catch (...) {
+		lua_settop(L, top-1);
+		throw;
+	}
+
+	lua_pop(L, 1);
+	return true;
+}
+
+MoveIter::~MoveIter() {
+	if (!lua || !lua->L) return;
+	luaL_unref(lua->L, LUA_REGISTRYINDEX, ref);
+	lua->pool->end_iter(iter_i);
+}
+
 Position LuaInterface::initial_position() {
 	Position pos;
 	pos.next_player = 0; // make customizable?
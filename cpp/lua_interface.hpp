@@ -7,6 +7,7 @@ extern "C" {
 }
 
 #include "util.hpp"
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
@@ -21,21 +22,100 @@ struct LuaException: public std::exception {
 	char const* what() const noexcept { return err.c_str(); }
 };
 
+struct LuaInterface;
+
+// Boards handed to the script, made once and overwritten in place after. A call takes
+// slots in order and gives them back when it returns (a MovesIter when it's destroyed),
+// so a script can't keep a board, or a clone of one, past the call it was given in.
+struct BoardPool {
+	// registry ref of the table holding the userdata, and the same as pointers
+	int ref=LUA_NOREF;
+	vec<void*> boards;
+	int used=0;
+	// per MovesIter in progress, oldest first: the first slot it took, and if it's done
+	vec<std::pair<int,bool>> iters;
+
+	// slots go back once every MovesIter started after this one is done too
+	void end_iter(int i) {
+		iters[i].second=true;
+		while (!iters.empty() && iters.back().second) {
+			used = iters.back().first;
+			iters.pop_back();
+		}
+	}
+};
+
+// Where the emit function handed to EmitMoves appends, set for each call.
+struct MoveSink {
+	// registry ref of emit, a closure over this
+	int ref=LUA_NOREF;
+	vec<Move>* out=nullptr;
+	Position const* pos=nullptr;
+	int n, m;
+	bool tags;
+};
+
+// A MovesIter call in progress, holds its function in the registry until destroyed.
+// Boards stay taken meanwhile, iterators must be destroyed newest first to free them.
+struct MoveIter {
+	LuaInterface* lua;
+	int ref;
+	// the position the moves are from, for derive_tags
+	Position pos;
+	// index in BoardPool::iters
+	int iter_i;
+
+	MoveIter(LuaInterface* lua_, int ref_, Position const& pos_, int iter_i_): lua(lua_), ref(ref_), pos(pos_), iter_i(iter_i_) {}
+	MoveIter(MoveIter const& other) = delete;
+	MoveIter(MoveIter&& other): lua(other.lua), ref(other.ref), pos(other.pos), iter_i(other.iter_i) {
+		other.lua = nullptr;
+	}
+	~MoveIter();
+
+	// false once the script has no more moves
+	bool next(Move& out);
+};
+
 struct LuaInterface {
 	lua_State* L;
 	int n,m; // Board dimensions found extracted from Lua
+	// the script defines MovesIter, see specification.lua
+	bool has_moves_iter=false;
+	// the script sets MOVE_TAGS, its moves say what they capture / promote / check
+	bool has_tags=false;
+	// the script defines EmitMoves, see specification.lua
+	bool has_emit=false;
+	// the script defines MovesWithStatus
+	bool has_status=false;
+	// the script sets NULL_MOVE / PROBCUT, opting in to those prunings
+	bool null_move_ok=false, probcut_ok=false;
+	// behind a pointer, boards point at it and LuaInterface moves
+	std::unique_ptr<BoardPool> pool;
+	std::unique_ptr<MoveSink> sink;
 
 	LuaInterface(): L(nullptr) {}
 	LuaInterface(std::string const& path);
 	LuaInterface(LuaInterface& other) = delete;
-	LuaInterface(LuaInterface&& other): L(other.L), n(other.n), m(other.m) {
+	LuaInterface(LuaInterface&& other): L(other.L), n(other.n), m(other.m),
+		has_moves_iter(other.has_moves_iter), has_tags(other.has_tags), has_emit(other.has_emit), has_status(other.has_status),
+		null_move_ok(other.null_move_ok), probcut_ok(other.probcut_ok),
+		pool(std::move(other.pool)), sink(std::move(other.sink)) {
 		other.L = nullptr;
 	}
 	~LuaInterface();
 
 	void push_position(Position const& position);
 	PosType get_pos_type(Position const& position);
+	// all moves: from EmitMoves if the script has it, else drained from MovesIter so
+	// every list is in its order, else from Moves
 	void valid_moves(vec<Move>& out, Position const& position);
+	// valid_moves, and get_pos_type of the position after each. one call to
+	// MovesWithStatus if the script has it
+	void moves_with_status(vec<Move>& out, vec<PosType>& status, Position const& position);
+	// moves one at a time, requires has_moves_iter
+	MoveIter moves_iter(Position const& position);
+	// the move table on top of the stack, tags from it or derived against position
+	void read_move(Move& move, Position const& position);
 	void check(int r);
 	void validate(Position const& init);
 
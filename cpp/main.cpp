@@ -1,9 +1,17 @@
 #include "util.hpp"
+#include "dfpn.hpp"
 #include "lua_interface.hpp"
 #include "server_io.hpp"
+#include "tablebase.hpp"
+#include "mcts.hpp"
+#include "search.hpp"
 #include "search2.hpp"
 #include "trainer.hpp"
 
+#include <chrono>
+#include <filesystem>
+#include <future>
+#include <map>
 #include <sstream>
 #include <iostream>
 
@@ -22,6 +30,19 @@ int main(int argc, char** argv) {
 	string ty; ss>>ty;
 	string lua_path; ss >> lua_path;
 
+	// trailing key=value options, e.g. main2 play game.lua threads=8 hash=256 movetime=2000 ponder
+	std::map<string, string> opts;
+	for (string opt; ss>>opt;) {
+		auto eq = opt.find('=');
+		if (eq==string::npos) opts[opt]="";
+		else opts[opt.substr(0, eq)] = opt.substr(eq+1);
+	}
+
+	auto opt_int = [&](string const& k, int def) {
+		auto it = opts.find(k);
+		return it==opts.end() ? def : stoi(it->second);
+	};
+
 	if (ty=="validate") {
 		cout << "trying validate\n";
 		try {
@@ -58,6 +79,46 @@ int main(int argc, char** argv) {
 			return 1;
 		}
 
+	} else if (ty=="solve") {
+		// proves the value of each position read after "n m npty", writing everything
+		// settled to out= (default <lua>.solved) for play's solved= option
+		ServerIO io;
+		int n,m,npty; cin>>n>>m>>npty;
+
+		DFPN dfpn(npty, n, m, opt_int("threads", 0), lua_path, opt_int("hash", 256));
+		dfpn.max_nodes = opt_int("nodes", 0);
+		string out_path = opts.contains("out") ? opts["out"] : lua_path+".solved";
+
+		while ((cin>>ws).peek()!=EOF) {
+			Position pos = io.receive_pos();
+			auto start = chrono::steady_clock::now();
+			PosType r = dfpn.solve(pos);
+			auto ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now()-start).count();
+
+			char const* names[] = {"win", "loss", "draw", "unknown"};
+			cout<<names[int(r)]<<" ("<<dfpn.nodes<<" nodes, "<<ms<<"ms)"<<endl;
+			dfpn.write(out_path, npty);
+		}
+
+	} else if (ty=="tbgen") {
+		// endgame tables for pieces= (comma separated types) and all its sub-sets, on the
+		// board read as "n m npty", into the directory out= (default .) for play's tb= option
+		int n,m,npty; cin>>n>>m>>npty;
+
+		vec<int> pieces;
+		stringstream ps(opts["pieces"]);
+		for (string p; getline(ps, p, ',');) if (!p.empty()) pieces.push_back(stoi(p));
+		if (pieces.empty() || pieces.size()>16) {
+			cerr<<"pieces= needs 1 to 16 piece types"<<endl;
+			return 1;
+		}
+
+		string dir = opts.contains("out") ? opts["out"] : ".";
+		filesystem::create_directories(dir);
+
+		TBGen gen(n, m, opt_int("threads", 0), lua_path);
+		gen.generate_all(pieces, dir);
+
 	} else if (ty=="play") {
 		// string weights_path; ss >> weights_path;
 		// ifstream weights_input_stream(weights_path);
@@ -69,18 +130,141 @@ int main(int argc, char** argv) {
 		ServerIO io;
 		int n,m,npty; cin>>n>>m>>npty;
 
-		Searcher search(npty, n, m, 1000, 0, lua_path);
-		auto& lua = search.interfaces[0];
+		// engine=ybw: threads split the nodes of one tree (search.hpp)
+		// engine=mcts: uct with random playouts (mcts.hpp), hash= sizes its node arena
+		unique_ptr<Searcher> engine;
+		if (opts.contains("engine") && opts["engine"]=="ybw") {
+			engine = make_unique<YBWSearcher>(npty, n, m, 1000, opt_int("threads", 0), lua_path,
+				opt_int("hash", 64), opt_int("movecache", 256), opt_int("typecache", 16));
+		} else if (opts.contains("engine") && opts["engine"]=="mcts") {
+			auto mcts = make_unique<MCTSSearcher>(npty, n, m, opt_int("threads", 0), lua_path, opt_int("hash", 256));
+			mcts->playout_plies = opt_int("playout", mcts->playout_plies);
+			engine = std::move(mcts);
+		} else {
+			engine = make_unique<Searcher>(npty, n, m, 1000, opt_int("threads", 0), lua_path,
+				opt_int("hash", 64), opt_int("movecache", 256), opt_int("typecache", 16));
+		}
+
+		Searcher& search = *engine;
+		search.tm.set_movetime(opt_int("movetime", Searcher::TIME_LIMIT));
+		// root driver: bisect (threads split each depth's bisection), pvs, mtdf, default lazy smp bisection
+		if (opts.contains("driver")) {
+			string d = opts["driver"];
+			if (d=="bisect") search.driver=Driver::Bisect;
+			else if (d=="pvs") search.driver=Driver::PVS;
+			else if (d=="mtdf") search.driver=Driver::MTDF;
+		}
+		// forward pruning toggles (0/1) and margins, e.g. lmr=0 rfp_margin=200
+		auto& pr = search.pruning;
+		pr.null_move = opt_int("nullmove", pr.null_move);
+		pr.lmr = opt_int("lmr", pr.lmr);
+		pr.futility = opt_int("futility", pr.futility);
+		pr.rfp = opt_int("rfp", pr.rfp);
+		pr.probcut = opt_int("probcut", pr.probcut);
+		pr.null_r = opt_int("null_r", pr.null_r);
+		pr.futility_margin = opt_int("futility_margin", pr.futility_margin);
+		pr.rfp_margin = opt_int("rfp_margin", pr.rfp_margin);
+		pr.probcut_margin = opt_int("probcut_margin", pr.probcut_margin);
+
+		// drop search state unused for this many moves after each reply, -1 keeps it all
+		int trim_age = opt_int("trim", -1);
+
+		// positions proven by solve, played from the table without searching
+		SolvedTable solved;
+		if (opts.contains("solved") && !solved.load(opts["solved"], n, m, npty)) {
+			cerr<<"can't use solved table "<<opts["solved"]<<endl;
+		}
+
+		// endgame tables from tbgen, probed by the search
+		TablebaseSet tbs;
+		if (opts.contains("tb")) {
+			if (tbs.load_dir(opts["tb"], n*m)) search.tb = &tbs;
+			else cerr<<"no tables in "<<opts["tb"]<<endl;
+		}
+
+		// own lua state for queries, the searcher's may be busy pondering
+		LuaInterface lua(lua_path);
 		vec<Move> moves;
 
+		// after replying, keep searching the position we expect the opponent to
+		// leave us in. if they do, the reply comes from that search
+		bool ponder_on = opts.contains("ponder");
+		future<Searcher::SearchOut> ponder;
+		Position ponder_pos;
+
+		auto same_pos = [n,m](Position const& a, Position const& b) {
+			return a.next_player==b.next_player && equal(a.board, a.board+n*m, b.board);
+		};
+
+		// positions played so far, for repetitions. set with query 4, otherwise each
+		// searched position and our reply to it are added. a change in the number of
+		// pieces (a capture, in most games) can't be undone, so what came before is dropped
+		vec<Position> game;
+		auto add_to_game = [&](Position const& p) {
+			auto pieces = [n,m](Position const& x) { return n*m - count(x.board, x.board+n*m, 0); };
+			if (!game.empty() && pieces(game.back())!=pieces(p)) game.clear();
+			game.push_back(p);
+		};
+
+		auto stop_ponder = [&]() {
+			search.tm.infinite=false;
+			// cancelled covers a ponder search that hasn't reached run() yet
+			search.cancelled=true, search.stop=true;
+			auto out = ponder.get();
+			search.cancelled=false;
+			return out;
+		};
+
+		auto start_ponder = [&](Position const& pos, Move const& reply) {
+			Position after = after_move(pos, reply);
+			if (search.pos_type(lua, after)!=PosType::Other) return;
+
+			moves.clear();
+			lua.valid_moves(moves, after);
+			int predicted = search.hash_move(after);
+			if (predicted<0 || predicted>=moves.size()) return;
+
+			ponder_pos = after_move(after, moves[predicted]);
+			if (search.pos_type(lua, ponder_pos)!=PosType::Other) return;
+
+			search.set_game(game);
+			search.tm.infinite=true;
+			search.stop=false;
+			ponder = async(launch::async, [&search, p=ponder_pos]() {
+				return search.search(p);
+			});
+		};
+
 		while (true) {
-			int query_type; cin>>query_type;
+			int query_type;
+			if (!(cin>>query_type)) break;
+
+			// time control for the following searches, no reply
+			// 2 <remaining ms> <increment ms>
+			// 3 <ms per move>
+			// game history before the next searched position, oldest first, no reply
+			// 4 <count> <position>...
+			if (query_type==2) {
+				int64_t remaining, inc; cin>>remaining>>inc;
+				search.tm.set_clock(remaining, inc);
+				continue;
+			} else if (query_type==3) {
+				int64_t movetime; cin>>movetime;
+				search.tm.set_movetime(movetime);
+				continue;
+			} else if (query_type==4) {
+				int k; cin>>k;
+				game.clear();
+				for (int i=0; i<k; i++) add_to_game(io.receive_pos());
+				continue;
+			}
+
 			Position pos = io.receive_pos();
 
 			if (query_type==0) {
 
 				int pty;
-				switch (lua.get_pos_type(pos)) {
+				switch (search.pos_type(lua, pos)) {
 					case PosType::Win: pty=1; break;
 					case PosType::Draw: pty=0; break;
 					case PosType::Loss: pty=-1; break;
@@ -92,18 +276,52 @@ int main(int argc, char** argv) {
 				moves.clear();
 				lua.valid_moves(moves, pos);
 				io.out.push_back(moves.size());
-				for (auto& move: moves) io.send_move(move,n,m);
+				for (auto& move: moves) io.send_move(pos,move,n,m);
 
 			} else if (query_type==1) {
 
-				auto search_out = search.search(pos);
+				Searcher::SearchOut search_out;
+				int solved_i = -1;
+				if (solved.zob) {
+					moves.clear();
+					lua.valid_moves(moves, pos);
+					solved_i = solved.best_move(pos, moves);
+				}
+
+				if (solved_i!=-1) {
+					if (ponder.valid()) stop_ponder();
+					search_out.possible.assign(moves.begin(), moves.end());
+					search_out.move_i = solved_i;
+				} else if (ponder.valid() && same_pos(pos, ponder_pos)) {
+					// ponder hit, our clock runs from here
+					search.tm.ponderhit();
+					search_out = ponder.get();
+				} else {
+					if (ponder.valid()) stop_ponder();
+					search.set_game(game);
+					search.stop=false;
+					search_out = search.search(pos);
+				}
+
 				if (search_out.move_i==-1) return 1;
-				io.send_move(search_out.possible[search_out.move_i], m, n);
+				Move const& reply = search_out.possible[search_out.move_i];
+				io.send_move(pos, reply, m, n);
+
+				io.flush();
 
+				Position after = after_move(pos, reply);
+				add_to_game(pos);
+				add_to_game(after);
+
+				if (trim_age>=0) search.trim(trim_age);
+				if (ponder_on) start_ponder(pos, reply);
+				continue;
 			}
 
 			io.flush();
 		}
+
+		if (ponder.valid()) stop_ponder();
 	} else {
 		cerr<<"unrecognized command "<<ty<<endl;
 		return 1;
@@ -71,13 +71,13 @@ int main(int argc, char** argv) {
 				moves.clear();
 				lua.valid_moves(moves, pos);
 				io.out.push_back(moves.size());
-				for (auto& move: moves) io.send_move(move,n,m);
+				for (auto& move: moves) io.send_move(pos,move,n,m);
 
 			} else if (query_type==1) {
 
 				auto search_out = search.search(pos);
 				if (search_out.move_i==-1) return 1;
-				io.send_move(search_out.possible[search_out.move_i], m, n);
+				io.send_move(pos, search_out.possible[search_out.move_i], m, n);
 
 			}
 
@@ -0,0 +1,255 @@
+#pragma once
+
+/*
+ * Monte Carlo Tree Search
+ *
+ * UCT for games where the static evaluation (piece_weights / pst) means nothing.
+ * Every thread runs selection -> expansion -> random playout -> backup on one shared
+ * tree, with its own lua state, on the Searcher's pool and time manager.
+ *
+ * Nodes live in a preallocated arena and keep their board, so descending needs no
+ * lua calls; a node's children are contiguous, in valid_moves order. Visits are
+ * counted on the way down, so a node a thread is in counts as a loss for the others
+ * (virtual loss) until its playout comes back. Scores are in half points for the
+ * player who moved into the node: 2 a win, 1 a draw.
+ *
+ * The tree is kept between searches: if the new root is a child or grandchild of the
+ * last one its subtree is searched on, otherwise (or once the arena is mostly full)
+ * it starts over.
+ *
+ * Usage:
+ *   MCTSSearcher s(max_pty, n, m, nt, lua_path, 256);  // 256MB of nodes
+ *   auto out = s.search(pos);
+ */
+
+#include "search2.hpp"
+#include <random>
+
+struct MCTSSearcher: Searcher {
+	// Node::first before expansion, and while a thread expands it
+	static constexpr int UNEXPANDED=-1, EXPANDING=-2;
+	// visits a leaf takes before it's expanded
+	static constexpr int EXPAND_VISITS = 2;
+	// Node::result before the node's first visit
+	static constexpr signed char UNKNOWN=-1;
+
+	struct Node {
+		std::atomic<uint32_t> visits=0, score=0;
+		// index of the first child in the arena
+		std::atomic<int> first=UNEXPANDED;
+		int n_children=0;
+		// PosType for the player to move, once visited
+		std::atomic<signed char> result=UNKNOWN;
+		Position pos;
+	};
+
+	std::unique_ptr<Node[]> arena;
+	int cap;
+	std::atomic<int> used=0;
+	int root=-1;
+
+	// exploration constant, and plies after which a playout counts as a draw
+	double uct_c=1.4;
+	int playout_plies=200;
+
+	std::atomic<uint64_t> playouts=0;
+
+	MCTSSearcher(int max_pty_, int n_, int m_, int nt_, std::string const& lua_path_, int mb=256):
+		Searcher(max_pty_, n_, m_, MAX_PLY, nt_, lua_path_, 1, 1),
+		arena(new Node[(size_t(mb)<<20)/sizeof(Node)]), cap((size_t(mb)<<20)/sizeof(Node)) {}
+
+	// half points for the player to move in a position of type pty
+	static int reward(PosType pty) {
+		return pty==PosType::Win ? 2 : pty==PosType::Loss ? 0 : 1;
+	}
+
+	int alloc(int k) {
+		if (used.load(std::memory_order_relaxed)+k > cap) return -1;
+		int i = used.fetch_add(k);
+		return i+k<=cap ? i : -1;
+	}
+
+	int new_root(Position const& pos) {
+		used=0;
+		int i = alloc(1);
+		Node& nd = arena[i];
+		nd.visits=0, nd.score=0, nd.first=UNEXPANDED, nd.n_children=0, nd.result=UNKNOWN;
+		nd.pos = pos;
+		return i;
+	}
+
+	// lists the node's children, false if another thread is at it or the arena is full
+	bool expand(Worker& t, Node& nd) {
+		int expected=UNEXPANDED;
+		if (!nd.first.compare_exchange_strong(expected, EXPANDING)) return false;
+
+		auto& moves = t.stack[0].moves;
+		moves.clear();
+		interfaces[t.lua_i].valid_moves(moves, nd.pos);
+
+		int first = alloc(std::max<int>(moves.size(), 1));
+		if (first<0) {
+			nd.first.store(UNEXPANDED, std::memory_order_release);
+			return false;
+		}
+
+		for (int k=0; k<moves.size(); k++) {
+			Node& c = arena[first+k];
+			c.visits=0, c.score=0, c.first=UNEXPANDED, c.n_children=0, c.result=UNKNOWN;
+			c.pos = after_move(nd.pos, moves[k]);
+		}
+
+		nd.n_children = moves.size();
+		nd.first.store(first, std::memory_order_release);
+		return true;
+	}
+
+	// uct over an expanded node's children, unvisited ones first
+	int select(Node const& nd, int first) {
+		double log_n = std::log(std::max<uint32_t>(nd.visits.load(std::memory_order_relaxed), 1));
+		int pick=first;
+		double best=-1;
+		for (int i=first; i<first+nd.n_children; i++) {
+			uint32_t v = arena[i].visits.load(std::memory_order_relaxed);
+			if (!v) return i;
+
+			double q = arena[i].score.load(std::memory_order_relaxed) / (2.0*v);
+			double u = q + uct_c*std::sqrt(log_n/v);
+			if (u>best) best=u, pick=i;
+		}
+
+		return pick;
+	}
+
+	// every thread checks before each iteration and each playout ply, a playout alone
+	// can be hundreds of lua calls. whoever sees the budget run out stops the rest
+	bool out_of_time() {
+		if (stop.load(std::memory_order_relaxed)) return true;
+		if (!tm.budget_expired()) return false;
+
+		stop=true;
+		return true;
+	}
+
+	// random moves from pos until the game ends, half points for pos's player to move.
+	// a playout cut short by the clock counts as a draw, the search is over anyway
+	int playout(Worker& t, Position pos, std::mt19937_64& rng) {
+		auto& lua = interfaces[t.lua_i];
+		auto& moves = t.stack[0].moves;
+
+		for (int ply=0; ply<playout_plies; ply++) {
+			if (out_of_time()) return 1;
+
+			PosType pty = pos_type(lua, pos);
+			if (pty!=PosType::Other) return ply%2 ? 2-reward(pty) : reward(pty);
+
+			moves.clear();
+			lua.valid_moves(moves, pos);
+			if (moves.empty()) return 1;
+
+			moves[rng()%moves.size()].delta.apply(pos.board);
+			pos.next_player^=1;
+		}
+
+		return 1;
+	}
+
+	// one selection / expansion / playout / backup from the root
+	void iteration(Worker& t, vec<int>& path, std::mt19937_64& rng) {
+		path.clear();
+		int i = root;
+		arena[i].visits.fetch_add(1, std::memory_order_relaxed);
+		path.push_back(i);
+
+		int r;
+		while (true) {
+			Node& nd = arena[i];
+
+			signed char res = nd.result.load(std::memory_order_relaxed);
+			if (res==UNKNOWN) {
+				res = static_cast<signed char>(pos_type(interfaces[t.lua_i], nd.pos));
+				nd.result.store(res, std::memory_order_relaxed);
+			}
+
+			// for the player who moved here
+			if (static_cast<PosType>(res)!=PosType::Other) {
+				r = 2-reward(static_cast<PosType>(res));
+				break;
+			}
+
+			int first = nd.first.load(std::memory_order_acquire);
+			if (first<0 && (path.size()==1 || nd.visits>=EXPAND_VISITS) && expand(t, nd))
+				first = nd.first.load(std::memory_order_acquire);
+
+			if (first<0 || !nd.n_children || path.size()>=MAX_PLY) {
+				r = 2-playout(t, nd.pos, rng);
+				playouts.fetch_add(1, std::memory_order_relaxed);
+				break;
+			}
+
+			i = select(nd, first);
+			arena[i].visits.fetch_add(1, std::memory_order_relaxed);
+			path.push_back(i);
+		}
+
+		for (int k=path.size()-1; k>=0; k--) {
+			arena[path[k]].score.fetch_add(r, std::memory_order_relaxed);
+			r = 2-r;
+		}
+	}
+
+	// the node for pos among the root's children and grandchildren, -1 if not there
+	int find_reused(Position const& pos) {
+		auto same = [&](Position const& a) {
+			return a.next_player==pos.next_player && std::equal(a.board, a.board+n*m, pos.board);
+		};
+
+		if (root<0) return -1;
+		if (same(arena[root].pos)) return root;
+
+		auto children = [&](int i, auto&& f) {
+			int first = arena[i].first.load();
+			if (first<0) return -1;
+			for (int c=first; c<first+arena[i].n_children; c++) {
+				int o = f(c);
+				if (o!=-1) return o;
+			}
+
+			return -1;
+		};
+
+		return children(root, [&](int c) {
+			return children(c, [&](int g) { return same(arena[g].pos) ? g : -1; });
+		});
+	}
+
+	SearchOut search(Position const& current) override {
+		int reuse = used<cap/4*3 ? find_reused(current) : -1;
+		uint32_t reused = reuse==-1 ? 0 : arena[reuse].visits.load();
+		root = reuse!=-1 ? reuse : new_root(current);
+		playouts=0;
+
+		auto out = run(current, [&](Worker& t, SearchState const&, SearchOut&) {
+			std::mt19937_64 rng(std::random_device{}() + t.lua_i);
+			vec<int> path;
+
+			while (!out_of_time()) iteration(t, path, rng);
+		});
+
+		// the most visited move, children are in out.possible's order
+		Node const& nd = arena[root];
+		int first = nd.first.load();
+		if (first>=0 && nd.n_children==out.possible.size()) {
+			uint32_t most=0;
+			for (int k=0; k<nd.n_children; k++) {
+				uint32_t v = arena[first+k].visits.load();
+				if (v>most) most=v, out.move_i=k;
+			}
+		}
+
+		int64_t ms = std::max<int64_t>(tm.elapsed(), 1);
+		std::cerr<<"mcts: "<<playouts<<" playouts, "<<playouts*1000/ms<<"/s, "
+			<<nd.visits<<" root visits ("<<reused<<" reused), "<<used<<"/"<<cap<<" nodes"<<std::endl;
+		return out;
+	}
+};
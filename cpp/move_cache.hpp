@@ -0,0 +1,163 @@
+#pragma once
+
+/*
+ * Bounded Move List Cache
+ *
+ * Maps a position hash to its expanded move list (anything with a bytes() member),
+ * evicting with CLOCK once the byte budget is reached. Split into mutex-guarded
+ * shards, each with its own slice of the budget and its own clock hand.
+ *
+ * Values are handed out as shared_ptr, so an entry evicted by one thread stays
+ * alive for a bound() that is still iterating over it.
+ *
+ * Entries can be protected for the current epoch (e.g. the few plies next to the
+ * root, re-expanded on every MTD probe); the clock hand skips them until new_epoch().
+ * Entries not used for more than an epoch get no second chance from their
+ * reference bit, and trim() drops everything older than a given age.
+ *
+ * Usage:
+ *   MoveCache<Bufs> c(256);  // 256MB
+ *   auto v = c.find(hash, protect);
+ *   if (!v) v = c.insert(hash, std::move(bufs), protect);
+ */
+
+#include "util.hpp"
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+template<class V>
+struct MoveCache {
+	static constexpr int SHARDS = 64;
+
+	struct Slot {
+		std::shared_ptr<V const> v;
+		uint64_t key;
+		size_t bytes;
+		int protect_epoch, used_epoch;
+		bool ref;
+	};
+
+	struct Shard {
+		std::mutex mut;
+		::map<uint64_t, int> index; // qualified, server_io.hpp pulls in namespace std
+		vec<Slot> slots;
+		vec<int> free;
+		size_t bytes=0, hand=0;
+	};
+
+	std::array<Shard, SHARDS> shards;
+	size_t shard_budget;
+	std::atomic<int> epoch=0;
+	std::atomic<uint64_t> hits=0, misses=0, evictions=0;
+
+	MoveCache(int mb): shard_budget((size_t(mb)<<20)/SHARDS) {}
+
+	Shard& shard(uint64_t key) {
+		return shards[(key>>32)%SHARDS];
+	}
+
+	std::shared_ptr<V const> find(uint64_t key, bool protect) {
+		Shard& sh = shard(key);
+		std::scoped_lock lock(sh.mut);
+
+		auto it = sh.index.find(key);
+		if (it==sh.index.end()) {
+			misses.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		hits.fetch_add(1, std::memory_order_relaxed);
+		Slot& s = sh.slots[it->second];
+		s.ref=true;
+		s.used_epoch=epoch;
+		if (protect) s.protect_epoch=epoch;
+		return s.v;
+	}
+
+	// returns the cached value if another thread got there first
+	std::shared_ptr<V const> insert(uint64_t key, V&& v, bool protect) {
+		size_t bytes = v.bytes();
+		auto ptr = std::make_shared<V const>(std::move(v));
+
+		Shard& sh = shard(key);
+		std::scoped_lock lock(sh.mut);
+
+		auto it = sh.index.find(key);
+		if (it!=sh.index.end()) return sh.slots[it->second].v;
+
+		evict(sh, bytes);
+
+		int i;
+		if (sh.free.empty()) {
+			i=sh.slots.size();
+			sh.slots.emplace_back();
+		} else {
+			i=sh.free.back();
+			sh.free.pop_back();
+		}
+
+		int cur_epoch = epoch;
+		sh.slots[i] = Slot {
+			.v=ptr, .key=key, .bytes=bytes,
+			.protect_epoch=protect ? cur_epoch : -1, .used_epoch=cur_epoch, .ref=true
+		};
+
+		sh.index[key]=i;
+		sh.bytes+=bytes;
+		return ptr;
+	}
+
+	// CLOCK: clear reference bits until an unreferenced, unprotected slot comes up.
+	// gives up after two sweeps, so a shard full of protected entries overshoots
+	void evict(Shard& sh, size_t need) {
+		int cur_epoch = epoch;
+		for (size_t steps=0; sh.bytes+need > shard_budget && steps < 2*sh.slots.size(); steps++) {
+			Slot& s = sh.slots[sh.hand];
+			sh.hand = (sh.hand+1)%sh.slots.size();
+
+			if (!s.v || s.protect_epoch==cur_epoch) continue;
+			if (s.ref && cur_epoch-s.used_epoch<=1) {
+				s.ref=false;
+				continue;
+			}
+
+			remove(sh, s);
+		}
+	}
+
+	void remove(Shard& sh, Slot& s) {
+		sh.index.erase(s.key);
+		sh.bytes-=s.bytes;
+		sh.free.push_back(&s-sh.slots.data());
+		s.v.reset();
+		evictions.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// drops entries unused for more than max_age epochs
+	void trim(int max_age) {
+		int cur_epoch = epoch;
+		for (Shard& sh: shards) {
+			std::scoped_lock lock(sh.mut);
+			for (Slot& s: sh.slots) {
+				if (s.v && cur_epoch-s.used_epoch>max_age) remove(sh, s);
+			}
+		}
+	}
+
+	// drops protection from the previous search
+	void new_epoch() {
+		epoch++;
+	}
+
+	size_t bytes() {
+		size_t o=0;
+		for (Shard& sh: shards) {
+			std::scoped_lock lock(sh.mut);
+			o+=sh.bytes;
+		}
+
+		return o;
+	}
+};
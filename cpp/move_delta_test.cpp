@@ -0,0 +1,140 @@
+#include "lua_interface.hpp"
+#include "search2.hpp"
+
+#ifndef BUILD_DEBUG
+#include <mimalloc-new-delete.h>
+#endif
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+// placing a piece turns every piece of the other side, so from the start a move
+// changes 13 squares and the reply 14. half the moves come as changes, half as boards
+static char const* FLIP = R"(
+piece_names = {[0] = ".", [1] = "w", [2] = "b"}
+
+BOARD_WIDTH = 4
+BOARD_HEIGHT = 4
+
+InitialBoard = {{2,2,2,2}, {2,2,2,2}, {2,2,2,2}, {0,0,0,0}}
+
+function Type(player, position)
+    local count = {[0] = 0, 0, 0}
+    for i = 1,4 do for j = 1,4 do
+        local p = position.get(i, j)
+        count[p] = count[p] + 1
+    end end
+
+    if count[0] > 0 then return nil end
+    local other = 3 - player
+    if count[player] > count[other] then return "win" end
+    if count[player] < count[other] then return "loss" end
+    return "draw"
+end
+
+function Moves(player, position)
+    local out = {}
+    for i = 1,4 do for j = 1,4 do
+        if position.get(i, j) == 0 then
+            local move = {from = {i, j}, to = {i, j}}
+            if j % 2 == 1 then
+                move.changes = {{i, j, player}}
+                for i2 = 1,4 do for j2 = 1,4 do
+                    if position.get(i2, j2) == 3 - player then
+                        table.insert(move.changes, {i2, j2, player})
+                    end
+                end end
+            else
+                move.board = position.clone()
+                move.board.set(i, j, player)
+                for i2 = 1,4 do for j2 = 1,4 do
+                    if position.get(i2, j2) == 3 - player then move.board.set(i2, j2, player) end
+                end end
+            end
+            table.insert(out, move)
+        end
+    end end
+    return out
+end
+)";
+
+static bool fail(char const* what) {
+	cerr<<"move_delta_test: "<<what<<endl;
+	return false;
+}
+
+static bool same_board(Position const& a, Position const& b) {
+	return equal(a.board, a.board+MAX_BOARD_SIZE, b.board);
+}
+
+// the delta alone: 20 changes, copied, moved and overwritten by a small one
+static bool big_delta() {
+	Position a {}, b {};
+	for (int x=0; x<20; x++) b.board[3*x%MAX_BOARD_SIZE] = 1 + x%2;
+
+	MoveDelta d;
+	d.set_diff(a.board, b.board, MAX_BOARD_SIZE);
+	if (!d.big() || d.n!=20) return fail("20 changes should be kept on the heap");
+
+	MoveDelta copied = d, moved = std::move(copied);
+	for (MoveDelta const* x: {&d, &moved}) {
+		Position p = a;
+		x->apply(p.board);
+		if (!same_board(p, b)) return fail("big delta doesn't apply");
+		if (x->after(a.board, 57)!=b.board[57]) return fail("after() on a big delta");
+	}
+
+	d = moved;
+	Position c = a;
+	c.board[5] = 2;
+	moved.set_diff(a.board, c.board, MAX_BOARD_SIZE);
+	if (moved.big() || moved.n!=1) return fail("one change should stay inline");
+
+	Position p = a;
+	d.apply(p.board);
+	return same_board(p, b) || fail("assigned delta doesn't apply");
+}
+
+// through the script and a search, which makes and unmakes the big moves
+static bool flip_game(string const& path) {
+	LuaInterface lua(path);
+	Position init = lua.initial_position();
+
+	vec<Move> moves;
+	lua.valid_moves(moves, init);
+	if (moves.size()!=4) return fail("expected 4 moves from the start");
+
+	for (Move const& move: moves) {
+		if (move.delta.n!=13) return fail("a first move changes 13 squares");
+
+		Position want = init;
+		for (int x=0; x<16; x++) if (want.board[x]) want.board[x]=1;
+		want.board[move.to.i*4 + move.to.j] = 1;
+		want.next_player = 1;
+
+		Position got = after_move(init, move);
+		if (!same_board(got, want) || got.next_player!=1) return fail("first move lands on the wrong board");
+	}
+
+	Searcher searcher(2, 4, 4, 4, 0, path);
+	searcher.tm.infinite = true;
+	auto out = searcher.search(init);
+
+	if (out.move_i<0 || out.possible.size()!=4) return fail("search found no move");
+	if (!same_board(searcher.workers[0].pos, init)) return fail("search left the board changed");
+	return true;
+}
+
+int main() {
+	auto path = filesystem::temp_directory_path() / "move_delta_test.lua";
+	ofstream(path)<<FLIP;
+
+	bool ok = big_delta() && flip_game(path.string());
+	filesystem::remove(path);
+
+	if (ok) cout<<"move_delta_test: ok"<<endl;
+	return ok ? 0 : 1;
+}
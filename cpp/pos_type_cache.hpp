@@ -0,0 +1,56 @@
+#pragma once
+
+/*
+ * Position Type Cache
+ *
+ * Fixed size, direct mapped table of get_pos_type results by position hash, so
+ * a position is only classified by the script once while it stays in the table.
+ * The type never depends on the search, entries stay valid across searches and
+ * games and are simply overwritten on collision.
+ *
+ * An entry is one 64 bit word, the hash with its low 3 bits replaced by type+1
+ * (0 is empty). Loads and stores are relaxed and can't tear, so the table is
+ * shared by all threads without locks. The low bits of the hash also pick the
+ * slot, so they aren't needed to tell positions apart.
+ *
+ * Usage:
+ *   PosTypeCache c(16);  // 16MB
+ *   PosType pty; if (!c.probe(hash, pty)) c.store(hash, pty = lua.get_pos_type(pos));
+ */
+
+#include "lua_interface.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+struct PosTypeCache {
+	static constexpr uint64_t TYPE_MASK = 7;
+
+	std::unique_ptr<std::atomic<uint64_t>[]> table;
+	uint64_t mask;
+
+	PosTypeCache(int mb) {
+		uint64_t n=1;
+		while (2*n*sizeof(uint64_t) <= (uint64_t(mb)<<20)) n*=2;
+
+		table.reset(new std::atomic<uint64_t>[n]());
+		mask=n-1;
+	}
+
+	bool probe(uint64_t hash, PosType& out) {
+		uint64_t e = table[hash&mask].load(std::memory_order_relaxed);
+		if (e==0 || (e&~TYPE_MASK)!=(hash&~TYPE_MASK)) return false;
+
+		out = static_cast<PosType>((e&TYPE_MASK)-1);
+		return true;
+	}
+
+	void store(uint64_t hash, PosType pty) {
+		uint64_t e = (hash&~TYPE_MASK) | (uint64_t(pty)+1);
+		table[hash&mask].store(e, std::memory_order_relaxed);
+	}
+
+	uint64_t bytes() const {
+		return (mask+1)*sizeof(uint64_t);
+	}
+};
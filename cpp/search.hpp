@@ -1,434 +1,348 @@
 #pragma once
 
-#include "lua_interface.hpp"
-#include "nn.hpp"
-#include "pool.hpp"
-#include "util.hpp"
-#include <chrono>
-#include <condition_variable>
-#include <latch>
-#include <memory>
-#include <mutex>
-#include <random>
-
-vec<char> piece_names = {
-	'P', 'N', 'B', 'R', 'Q', 'K'
-};
+/*
+ * Young Brothers Wait Search
+ *
+ * Same tables, evaluation and root bisection as the search2.hpp Searcher, but the
+ * threads work on one tree instead of each running its own (lazy smp).
+ *
+ * At nodes with depth >= SPLIT_DEPTH the first child (eldest brother) is searched
+ * alone. If it doesn't fail high, the rest become tasks on the thread's deque and
+ * the node waits on an atomic count of pending children. Meanwhile the thread runs
+ * its own tasks, newest first, and steals the oldest from other threads once out.
+ * Idle helpers only steal. Shallower nodes are searched with the serial bound().
+ *
+ * A child failing high sets the node's cut flag. Anything searched under it sees the
+ * flag through the Split chain (checked in bound() every TIME_CHECK_NODES) and gives
+ * up, tasks not started yet are dropped when popped. Aborts stay inside the task that
+ * hit them, a node only returns once all its tasks are accounted for. Any other
+ * exception from a task cuts its node and is rethrown by the owner once they are.
+ *
+ * A stolen task's path to the root runs through the owners' stacks, recorded in each
+ * Split, so repetitions are found across threads. Repetitions going above a task are
+ * reported back to its node in the owner's ply numbering.
+ *
+ * Usage:
+ *   YBWSearcher s(max_pty, n, m, max_depth, nt, lua_path);
+ *   auto out = s.search(pos);
+ */
+
+#include "search2.hpp"
+#include <algorithm>
+#include <deque>
+#include <exception>
+#include <thread>
+
+struct YBWSearcher: Searcher {
+	// below this depth, children aren't worth handing to other threads
+	static constexpr int SPLIT_DEPTH = 3;
+
+	struct Node: Split {
+		int gamma;
+		// score<<32 | move_i, of the best child so far
+		std::atomic<int64_t> best;
+		std::atomic<int> pending=0;
+		// a child's search was abandoned, so a fail low isn't a bound
+		std::atomic<bool> aborted=false;
+		// lowest Frame::cycle over the children, as a ply of the owner
+		std::atomic<int> cycle=NO_CYCLE;
+		// first exception other than SearchAbort from a child, for the owner to rethrow
+		std::mutex err_mut;
+		std::exception_ptr err;
+
+		Node(Split const* parent_, Frame const* stack_, int ply_, int base_, int gamma_, int best_, int best_move_i):
+			Split(parent_, stack_, ply_, base_), gamma(gamma_), best(pack(best_, best_move_i)) {}
+
+		static int64_t pack(int score, int move_i) {
+			return (int64_t(score)<<32) | uint32_t(move_i);
+		}
 
-vec<int> piece_weights = {
-	100, 280, 320, 479, 929, 60000
-};
+		void update(int score, int move_i) {
+			int64_t cur = best.load(std::memory_order_relaxed);
+			while (score > int(cur>>32) && !best.compare_exchange_weak(cur, pack(score, move_i)));
 
-vec<vec<int>> pst = {
-	{   0,   0,   0,   0,   0,   0,   0,   0,
-		78,  83,  86,  73, 102,  82,  85,  90,
-		 7,  29,  21,  44,  40,  31,  44,   7,
-		 -17,  16,  -2,  15,  14,   0,  15, -13,
-		 -26,   3,  10,   9,   6,   1,   0, -23,
-		 -22,   9,   5, -11, -10,  -2,   3, -19,
-		 -31,   8,  -7, -37, -36, -14,   3, -31,
-		 0,   0,   0,   0,   0,   0,   0,   0},
-	{ -66, -53, -75, -75, -10, -55, -58, -70,
-		-3,  -6, 100, -36,   4,  62,  -4, -14,
-		10,  67,   1,  74,  73,  27,  62,  -2,
-		24,  24,  45,  37,  33,  41,  25,  17,
-		-1,   5,  31,  21,  22,  35,   2,   0,
-		 -18,  10,  13,  22,  18,  15,  11, -14,
-		 -23, -15,   2,   0,   2,   0, -23, -20,
-		 -74, -23, -26, -24, -19, -35, -22, -69},
-	{ -59, -78, -82, -76, -23,-107, -37, -50,
-		 -11,  20,  35, -42, -39,  31,   2, -22,
-		-9,  39, -32,  41,  52, -10,  28, -14,
-		25,  17,  20,  34,  26,  25,  15,  10,
-		13,  10,  17,  23,  17,  16,   0,   7,
-		14,  25,  24,  15,   8,  25,  20,  15,
-		19,  20,  11,   6,   7,   6,  20,  16,
-		-7,   2, -15, -12, -14, -15, -10, -10},
-	{  35,  29,  33,   4,  37,  33,  56,  50,
-		55,  29,  56,  67,  55,  62,  34,  60,
-		19,  35,  28,  33,  45,  27,  25,  15,
-		 0,   5,  16,  13,  18,  -4,  -9,  -6,
-		 -28, -35, -16, -21, -13, -29, -46, -30,
-		 -42, -28, -42, -25, -25, -35, -26, -46,
-		 -53, -38, -31, -26, -29, -43, -44, -53,
-		 -30, -24, -18,   5,  -2, -18, -31, -32},
-	{   6,   1,  -8,-104,  69,  24,  88,  26,
-		14,  32,  60, -10,  20,  76,  57,  24,
-		-2,  43,  32,  60,  72,  63,  43,   2,
-		 1, -16,  22,  17,  25,  20, -13,  -6,
-		 -14, -15,  -2,  -5,  -1, -10, -20, -22,
-		 -30,  -6, -13, -11, -16, -11, -16, -27,
-		 -36, -18,   0, -19, -15, -15, -21, -38,
-		 -39, -30, -31, -13, -31, -36, -34, -42},
-	{   4,  54,  47, -99, -99,  60,  83, -62,
-		 -32,  10,  55,  56,  56,  55,  10,   3,
-		 -62,  12, -57,  44, -67,  28,  37, -31,
-		 -55,  50,  11,  -4, -19,  13,   0, -49,
-		 -55, -43, -52, -28, -51, -47,  -8, -50,
-		 -47, -42, -43, -79, -64, -32, -29, -32,
-		-4,   3, -14, -50, -57, -18,  13,   4,
-		17,  30,  -3, -14,   6,  -1,  40,  18}
-};
+			if (score>=gamma) cut=true;
+		}
 
-constexpr int LOSING = -1e5+200;
-constexpr int WINNING = 1e5;
+		void add_cycle(int c) {
+			int cur = cycle.load(std::memory_order_relaxed);
+			while (c<cur && !cycle.compare_exchange_weak(cur, c));
+		}
 
-constexpr int QS = 40;
-constexpr int QS_A = 140;
-constexpr int EVAL_ROUGHNESS = 15;
-constexpr int MIN_DEPTH = 20;
+		// the rest of the node's children are pointless once one failed
+		void fail(std::exception_ptr e) {
+			std::scoped_lock lock(err_mut);
+			if (!err) err=e;
+			cut=true;
+		}
+	};
+
+	// a child of a split node, with what make() would have put in its frame
+	struct Task {
+		Node* node;
+		int move_i, gamma;
+		Position pos;
+		uint64_t hash;
+		Eval ev;
+		int score, depth;
+		uint32_t key;
+	};
+
+	// owner pushes / pops the back, thieves take the front
+	struct TaskQueue {
+		std::mutex mut;
+		std::deque<Task> q;
+	};
 
-struct SearchState {
-	PosType pos_ty;
-	Position pos;
-	uint64_t hash;
-	int score;
+	std::unique_ptr<TaskQueue[]> queues;
+	std::atomic<uint64_t> splits=0, steals=0;
 
-	int depth;
-	bool visited=false;
+	YBWSearcher(int max_pty_, int n_, int m_, int max_depth_,
+		int nt_, std::string const& lua_path_, int tt_mb=64, int pos_c_mb=256, int types_mb=16):
+		Searcher(max_pty_, n_, m_, max_depth_, nt_, lua_path_, tt_mb, pos_c_mb, types_mb),
+		queues(new TaskQueue[nt_+1]) {}
 
-	std::condition_variable wait;
-	std::mutex mut;
-	int n_wait=0;
+	bool pop(int lua_i, Task& out) {
+		TaskQueue& tq = queues[lua_i];
+		std::scoped_lock lock(tq.mut);
+		if (tq.q.empty()) return false;
 
-	int move_i;
-	SearchState* parent;
-	std::atomic_flag kill_children;
-	int best=LOSING, best_move_i=-1;
-	// bool can_null=false;
+		out = tq.q.back();
+		tq.q.pop_back();
+		return true;
+	}
 
-	SearchState(PosType pos_ty, Position pos, uint64_t hash, int score, int move_i, int depth, SearchState* parent):
-		pos_ty(pos_ty), pos(pos), hash(hash), score(score), depth(depth), move_i(move_i), parent(parent) {}
-};
+	bool steal(int lua_i, Task& out) {
+		for (int k=1; k<=nt; k++) {
+			TaskQueue& tq = queues[(lua_i+k)%(nt+1)];
+			std::scoped_lock lock(tq.mut);
+			if (tq.q.empty()) continue;
 
-struct SearchStateCache {
-	// lo <= optimal score <= hi
-	std::array<int,2> lo, hi;
-	SearchStateCache(): lo({LOSING,-1}), hi({WINNING,-1}) {}
-};
-
-#ifdef BUILD_DEBUG
-template<class V>
-using SearchAlloc = std::allocator<std::pair<uint64_t, V>>;
-#else
-template<class V>
-using SearchAlloc = mi_stl_allocator<std::pair<uint64_t, V>>;
-#endif
-
-struct Searcher {
-	int max_pty, n, m, max_depth;
-	vec<vec<uint64_t>> pt_pos_hash;
-	vec<uint64_t> depth_hash;
-	vec<LuaInterface> interfaces;
-
-	Pool pool;
-	std::string const& lua_path;
-	Position current;
-	uint64_t player_hash;
-
-	gtl::parallel_flat_hash_map<uint64_t, int, std::identity,
-	std::equal_to<uint64_t>, SearchAlloc<int>, 6, std::mutex> killer_move;
-
-	gtl::parallel_flat_hash_map<uint64_t, SearchStateCache, std::identity,
-		std::equal_to<uint64_t>, SearchAlloc<SearchStateCache>, 6, std::mutex> cache;
-	
-	Searcher(int max_pty_, int n_, int m_, int max_depth_, int nt_, std::string const& lua_path_, Position current_):
-		max_pty(max_pty_), n(n_), m(m_), max_depth(max_depth_),
-		pool(nt_), lua_path(lua_path_), current(current_) {
-
-		std::mt19937_64 rng(123);
-		player_hash = rng();
-
-		pt_pos_hash.resize(max_pty+1);
-		for (int pt=0; pt<=max_pty; pt++) {
-			pt_pos_hash[pt].resize(n*m);
-			for (int i=0; i<n; i++) for (int j=0; j<m; j++) pt_pos_hash[pt][i*m + j]=rng();
+			out = tq.q.front();
+			tq.q.pop_front();
+			steals.fetch_add(1, std::memory_order_relaxed);
+			return true;
 		}
 
-		depth_hash.resize(max_depth+MIN_DEPTH+1);
-		for (int i=-MIN_DEPTH; i<=max_depth; i++) {
-			depth_hash[i+MIN_DEPTH] = rng();
-		}
+		return false;
+	}
+
+	// runs one task on top of t's stack at ply, leaving t as it was. false if none found
+	bool run_one(Worker& t, int ply) {
+		Task task;
+		if (!pop(t.lua_i, task) && !steal(t.lua_i, task)) return false;
+
+		Node& nd = *task.node;
+		if (stop.load(std::memory_order_relaxed) || nd.cut_above()) {
+			nd.aborted=true;
+		} else {
+			Position saved = t.pos;
+			Split const* saved_split = t.split;
+			int saved_base = t.base_ply;
+
+			Frame& c = t.stack[ply];
+			c.hash=task.hash, c.ev=task.ev, c.score=task.score, c.depth=task.depth, c.key=task.key;
+			c.null=false, c.verify=false;
+			t.pos = task.pos;
+			t.split = &nd;
+			t.base_ply = ply;
+
+			try {
+				nd.update(-ybw(t, ply, task.gamma), task.move_i);
+				// c is at nd.ply+1 for the owner
+				if (c.cycle!=NO_CYCLE) nd.add_cycle(c.cycle - ply + nd.ply+1);
+			} catch (SearchAbort&) {
+				nd.aborted=true;
+			} catch (...) {
+				nd.aborted=true;
+				nd.fail(std::current_exception());
+			}
 
-		for (int i=0; i<=nt_; i++) {
-			interfaces.emplace_back(lua_path);
+			t.pos = saved;
+			t.split = saved_split;
+			t.base_ply = saved_base;
 		}
+
+		// last touch of nd, its owner may return as soon as this hits 0
+		nd.pending.fetch_sub(1, std::memory_order_release);
+		return true;
+	}
+
+	// drops nd's tasks still waiting in the owner's deque, as abandoned
+	void drain(int lua_i, Node& nd) {
+		TaskQueue& tq = queues[lua_i];
+		std::scoped_lock lock(tq.mut);
+		auto it = std::remove_if(tq.q.begin(), tq.q.end(), [&](Task const& x) { return x.node==&nd; });
+		int k = tq.q.end()-it;
+		if (!k) return;
+
+		tq.q.erase(it, tq.q.end());
+		nd.aborted=true;
+		nd.pending.fetch_sub(k, std::memory_order_release);
 	}
 
-	uint64_t hash(Position& pos) {
-		uint64_t o=0;
-		if (pos.next_player) o^=player_hash;
-		for (int i=0; i<n*m; i++) {
-			o^=pt_pos_hash[pos.board[i]][i];
+	// bound() with the children of deep nodes searched in parallel
+	int ybw(Worker& t, int ply, int gamma) {
+		Frame& f = t.stack[ply];
+		// tasks run on top of the stack, keep room for the subtree
+		if (f.depth<SPLIT_DEPTH || ply>=MAX_PLY/2) return bound(t, ply, gamma);
+		if (stop.load(std::memory_order_relaxed) || (t.split && t.split->cut_above())) throw SearchAbort();
+		t.nodes++;
+
+		f.cycle = NO_CYCLE;
+		if (ply && repeated(t, ply)) return 0;
+
+		int tb_score;
+		if (ply && probe_tb(t, tb_score)) return tb_score;
+
+		TTData tte{};
+		bool tt_hit = cache.probe(f.hash, tte);
+		if (tt_hit && tte.depth>=f.depth) {
+			if (!ply) t.root_move=tte.move_i;
+			if (tte.lo>=gamma) return tte.lo;
+			else if (tte.hi<gamma) return tte.hi;
 		}
 
-		return o;
-	}
+		int hash_i = tt_hit ? tte.move_i : -1;
+		if (hash_i==-1) {
+			// iid, as in bound()
+			int cyc = f.cycle;
+			f.depth-=3;
+			ybw(t, ply, gamma);
+			f.depth+=3;
+			f.cycle = std::min(f.cycle, cyc);
 
-	void change(SearchState& state, Move& move) {
-		auto& pos = state.pos;
-		state.hash^=player_hash;
-		
-		for (int i=0; i<n*m; i++) {
-			if (move.board[i] != pos.board[i]) {
-				state.hash^=pt_pos_hash[pos.board[i]][i]^pt_pos_hash[move.board[i]][i];
-				std::swap(move.board[i], pos.board[i]);
-			}
+			hash_i = tt_move(f.hash);
 		}
 
-		state.pos.next_player^=1;
-		state.score = score(state.pos); //FIXME: optimize when replace with nnue
-	}
+		bool protect = ply<protect_ply;
+		auto bufs = pos_c.find(f.hash, protect);
+		if (!bufs) bufs = expand(t, ply, protect);
+		auto& b = *bufs;
 
-	int score(Position& pos) {
-		int o1=0,o2=0;
-		for (int i=0; i<n; i++) for (int j=0; j<m; j++) {
-			int x = i*m+j;
-			if (pos.board[x]){
-				if (pos.board[x] <= 6){
-					//std::cout << pos.board[x] - 1 << ' ' << x << ' ' << pst[pos.board[x] - 1][x] << '\n';
-					o1+=piece_weights[pos.board[x]-1] + pst[pos.board[x] - 1][x];
-				}
-				else {
-					//std::cout << pos.board[x] - 6 - 1 << ' ' << x << ' ' << pst[pos.board[x] - 6 - 1][x] << '\n';
-					o2+=piece_weights[pos.board[x]-6-1] + pst[pos.board[x] - 6 - 1][x];
-				}
+		int best=LOSING, best_move_i=-1;
+		auto ret = [&]() {
+			if (f.cycle>=ply) {
+				if (best<gamma) cache.store(f.hash, f.depth, LOSING, best, best_move_i);
+				else cache.store(f.hash, f.depth, best, WINNING, best_move_i);
 			}
+
+			if (best>=gamma && best_move_i!=-1) update_order(t, ply, b, best_move_i, {});
+			if (!ply) t.root_move=best_move_i;
+			return best;
+		};
+
+		if (hash_i>=int(b.t1.size())) hash_i=-1;
+
+		int min_score = QS - QS_A*f.depth + f.score;
+		if (hash_i!=-1 && !searchable(f, b, hash_i, min_score)) hash_i=-1;
+		order_moves(t, ply, b, hash_i, min_score);
+
+		auto& order = f.order;
+		if (order.empty()) return ret();
+
+		// eldest brother
+		make(t, ply, b.t1[order[0]]);
+		t.stack[ply+1].score = b.t3[order[0]];
+		best = -ybw(t, ply+1, 1-gamma);
+		best_move_i = order[0];
+		unmake(t, ply);
+		add_cycle(t, ply);
+
+		if (best>=gamma || order.size()==1) return ret();
+
+		Node node(t.split, t.stack.data(), ply, t.base_ply, gamma, best, best_move_i);
+		node.pending = order.size()-1;
+		splits.fetch_add(1, std::memory_order_relaxed);
+
+		// made before any is queued, nothing can point at node if make() throws.
+		// pushed worst first, so the owner pops the most promising
+		vec<Task> tasks;
+		for (int k=order.size()-1; k>=1; k--) {
+			int i = order[k];
+			make(t, ply, b.t1[i]);
+			Frame& c = t.stack[ply+1];
+			tasks.push_back(Task {
+				.node=&node, .move_i=i, .gamma=1-gamma, .pos=t.pos,
+				.hash=c.hash, .ev=c.ev, .score=b.t3[i], .depth=c.depth, .key=c.key
+			});
+			unmake(t, ply);
 		}
-		return pos.next_player ? o2-o1 : o1-o2;
-	}
-	int n_calls=0;
 
-	// ab with [gamma, gamma+1]
-	// fails low: <gamma
-	// fails high: >=gamma+1
-	std::optional<std::pair<Move, int>> bound(int gamma, int depth) {
-		int init_player = current.next_player;
+		{
+			TaskQueue& tq = queues[t.lua_i];
+			std::scoped_lock lock(tq.mut);
+			tq.q.insert(tq.q.end(), tasks.begin(), tasks.end());
+		}
 
-		std::mutex mut;
-		vec<std::unique_ptr<SearchState>> stack;
-
-		auto init = std::make_unique<SearchState>(
-			interfaces[0].get_pos_type(current), current, hash(current),
-			score(current), -1, depth, nullptr
-		);
-
-		if (init->pos_ty!=PosType::Other) return std::nullopt;
-
-		vec<Move> init_moves;
-		interfaces[0].valid_moves(init_moves, current);
-
-		stack.push_back(std::move(init));
-		int out_move_i=-1, out;
-
-		pool.launch_all([&](int ti) {
-			vec<Move> moves;
-			vec<std::unique_ptr<SearchState>> tmp;
-			auto& lua = interfaces[ti];
-
-			std::unique_lock lock(mut, std::defer_lock_t());
-			while (true) {
-				lock.lock();
-				if (stack.empty()) return;
-				auto state = std::move(stack.back());
-				auto& s = *state;
-				std::unique_lock self_lock(s.mut);
-				stack.pop_back();
-				lock.unlock();
-
-				int g = s.pos.next_player==init_player ? 1-gamma : gamma;
-
-				auto update_parent = [&]() {
-					if (!s.parent) {
-						out_move_i = s.best_move_i;
-						out = s.best;
-						return;
-					}
-
-					// N/A if leaf / end of quiescence search
-					if (s.best_move_i!=-1) {
-						killer_move.insert_or_assign(s.hash, s.best_move_i);
-
-						uint64_t k = s.hash^depth_hash[MIN_DEPTH+s.depth];
-
-						cache.emplace(k, SearchStateCache());
-						cache.modify_if(k, [x=s.best,y=s.best_move_i,g](std::pair<const uint64_t,SearchStateCache>& kv){
-							auto& v = kv.second;
-							if (x<g) v.lo = std::max(v.lo, {x,y});
-							else v.hi = std::min(v.hi, {x,y});
-						});
-					}
-
-					std::unique_lock lck2(s.parent->mut);
-					// move i = -1 when killer move search / IID
-					if (s.move_i!=-1 && -s.best>s.parent->best) {
-						s.parent->best = -s.best;
-						s.parent->best_move_i=s.move_i;
-
-						int g_parent = s.pos.next_player==init_player ? 1-gamma : gamma;
-						if (-s.best >= g_parent) {
-							s.parent->kill_children.notify_all();
-						}
-					}
-
-					if (--s.parent->n_wait <= 0) s.parent->wait.notify_all();
-				};
-
-				bool ex = s.parent && s.parent->kill_children.test();
-				if (ex) s.kill_children.notify_all();
-				while (s.n_wait>0) s.wait.wait(self_lock);
-
-				if (ex) {
-					std::unique_lock lck2(s.parent->mut);
-					if (--s.parent->n_wait <= 0) s.parent->wait.notify_all();
-					continue;
-				}
-
-				if (s.visited) {
-					update_parent();
-					continue;
-				}
-
-				uint64_t k = s.hash^depth_hash[MIN_DEPTH+s.depth];
-
-				cache.if_contains(k, [g,&s](std::pair<const uint64_t,SearchStateCache> const& kv){
-					if (kv.second.lo[0]>=g) std::tie(s.best, s.best_move_i)=kv.second.lo;
-					else if (kv.second.hi[0]<g) std::tie(s.best, s.best_move_i)=kv.second.hi;
-				});
-
-				if (s.best_move_i!=-1) {
-					update_parent();
-					continue;
-				}
-
-				if ((s.depth<=0 && s.score>=g) || s.depth<=-MIN_DEPTH || s.pos_ty!=PosType::Other) {
-					s.best = s.score;
-					update_parent();
-					continue;
-				}
-
-				auto it2 = killer_move.find(s.hash);
-				if (it2==killer_move.end() && s.depth > 3) {
-					s.n_wait=1;
-
-					std::unique_ptr<SearchState> new_state = std::make_unique<SearchState>(
-						s.pos_ty, s.pos, s.hash,
-						s.score, -1, s.depth-3, state.get()
-					);
-
-					lock.lock();
-
-					stack.push_back(std::move(state));
-					stack.push_back(std::move(new_state));
-
-					lock.unlock();
-					continue;
-				}
-				
-				moves.clear();
-				lua.valid_moves(moves, s.pos);
-				n_calls++;
-
-				tmp.clear();
-				int n_move=0;
-				assert(!moves.empty());
-				for (auto& move: moves) {
-					change(s, move);
-
-					auto pos_type = lua.get_pos_type(s.pos);
-					n_calls++;
-					auto& new_state = tmp.emplace_back(
-						std::make_unique<SearchState>(
-							pos_type, s.pos, s.hash,
-							s.score, n_move, s.depth-1, state.get()
-						)
-					);
-						
-					if (pos_type==PosType::Win) new_state->score = WINNING;
-					else if (pos_type==PosType::Loss) new_state->score = LOSING;
-					else if (pos_type==PosType::Draw) new_state->score = 0;
-
-					change(s, move);
-
-					n_move++;
-				}
-
-				auto tmp_it = tmp.begin();
-				if (it2!=killer_move.end()) {
-					swap(tmp[it2->second], tmp[0]);
-					tmp_it++;
-				}
-
-				using TmpV = std::unique_ptr<SearchState>;
-				std::sort(tmp_it, tmp.end(),
-					[](TmpV const& a, TmpV const& b) {
-						return b->score < a->score;
-					}
-				);
-
-				int min_score = s.score + QS - QS_A*s.depth;
-
-				lock.lock();
-				stack.push_back(std::move(state));
-				s.visited=true;
-				s.n_wait=0;
-
-				bool got_move=false;
-				for (auto& new_state: tmp) {
-					if (got_move && -new_state->score < min_score) {
-						break;
-					}
-
-					got_move=true;
-
-					if (s.depth<=1 && new_state->score >= 1-g) {
-						s.best = -new_state->score;
-						assert(new_state->move_i!=-1);
-						s.best_move_i = new_state->move_i;
-						break;
-					}
-
-					s.n_wait++;
-					stack.push_back(std::move(new_state));
-				}
-
-				lock.unlock();
+		// run_one doesn't throw, so node outlives every task pointing at it
+		while (node.pending.load(std::memory_order_acquire)>0) {
+			if (stop.load(std::memory_order_relaxed) || node.cut.load(std::memory_order_relaxed)) {
+				drain(t.lua_i, node);
+				if (node.pending.load(std::memory_order_acquire)==0) break;
 			}
-		}, pool.threads.size()+1);
+			if (!run_one(t, ply+1)) std::this_thread::yield();
+		}
+
+		if (node.err) std::rethrow_exception(node.err);
+
+		int64_t nb = node.best.load(std::memory_order_relaxed);
+		best = int(nb>>32), best_move_i = int(uint32_t(nb));
+		f.cycle = std::min(f.cycle, node.cycle.load());
 
-		assert(out_move_i!=-1);
-		return std::make_optional<std::pair<Move,int>>({init_moves[out_move_i], out});
+		// a fail high stands even if some siblings were abandoned
+		if (best<gamma && node.aborted) throw SearchAbort();
+		return ret();
 	}
 
-	static constexpr int TIME_LIMIT = 100000000;
-	std::optional<Move> search() {
-		auto start = std::chrono::steady_clock::now();
-		std::optional<Move> best;
-		bool tle=false;
-
-		for (int depth=1; !tle && depth<=max_depth; depth++) {
-			// std::cout<<"depth "<<depth<<", cache size "<<cache.size()<<", lua calls "<<n_calls<<std::endl;
-
-			auto now = std::chrono::steady_clock::now();
-
-			std::optional<Move> best2;
-			int lo=LOSING, hi=WINNING;
-			while (!tle && hi-lo > EVAL_ROUGHNESS) {
-				int mid = (hi+lo+1)
-				/2;
-				auto ret = bound(mid, depth);
-				if (!ret){
-					return std::nullopt;
-				}
-				if (ret->second >= mid) lo=mid; else hi=mid-1;
-				best2=ret->first;
-
-				tle|=std::chrono::duration_cast<std::chrono::milliseconds>(now-start).count() > TIME_LIMIT;
+	// serial bisection at the root with ybw() probes, like iterate() on the main thread
+	void deepen(Worker& t, SearchState const& init, SearchOut& out) {
+		t.pos = init.pos;
+		t.nodes = 0;
+		t.split = nullptr;
+		t.base_ply = 0;
+
+		Frame& root = t.stack[0];
+		root.hash=init.hash, root.ev=init.ev, root.score=init.score, root.key=NO_KEY;
+
+		for (int depth=1; depth<=max_depth; depth++) {
+			if (depth>1 && tm.soft_expired()) break;
+			print_depth(depth);
+
+			int lo=LOSING, hi=WINNING, move_i=-1, probes=0;
+			while (hi-lo > EVAL_ROUGHNESS) {
+				int mid = (hi+lo+1)/2;
+
+				root.depth = depth;
+				t.root_move = -1;
+				auto ret = ybw(t, 0, mid);
+				probes++;
+
+				if (ret >= mid) lo=mid, move_i=t.root_move;
+				else hi=mid-1;
 			}
 
-			best=best2;
+			out.move_i = move_i!=-1 ? move_i : tt_move(init.hash);
+			out.record(tm.elapsed(), probes, t.nodes);
+		}
+
+		std::cerr<<"ybw: "<<splits<<" splits, "<<steals<<" steals"<<std::endl;
+	}
+
+	// helpers steal until the main thread is done
+	void help(Worker& t) {
+		t.split = nullptr;
+		while (!stop.load(std::memory_order_relaxed)) {
+			if (!run_one(t, 1)) std::this_thread::yield();
 		}
+	}
 
-		return best;
+	SearchOut search(Position const& current) override {
+		splits=0, steals=0;
+
+		return run(current, [&](Worker& t, SearchState const& init, SearchOut& out) {
+			if (!t.lua_i) deepen(t, init, out);
+			else help(t);
+		});
 	}
-};
\ No newline at end of file
+};
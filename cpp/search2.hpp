@@ -1,12 +1,27 @@
 #pragma once
 
 #include "lua_interface.hpp"
+#include "move_cache.hpp"
 #include "pool.hpp"
+#include "pos_type_cache.hpp"
+#include "tablebase.hpp"
+#include "time_manager.hpp"
+#include "tt.hpp"
 #include "util.hpp"
+#include "zobrist.hpp"
+#include <atomic>
+#include <bit>
+#include <cassert>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <exception>
 #include <mutex>
 #include <numeric>
+#include <optional>
 #include <random>
+#include <span>
+#include <thread>
 
 // vec<char> piece_names = {
 // 	'P', 'N', 'B', 'R', 'Q', 'K', 
@@ -70,102 +85,378 @@ vec<vec<int>> pst = {
 
 constexpr int LOSING = -1e5;
 constexpr int WINNING = 1e5;
+static_assert(LOSING>=-TT::MAX_SCORE && WINNING<=TT::MAX_SCORE, "the tt can't hold every score");
 
+// moves whose static score drops more than QS_A*depth - QS below the node's are skipped
 constexpr int QS = 40;
 constexpr int QS_A = 140;
+// quiescence delta pruning: a capture whose static score + QS_DELTA can't reach gamma
+constexpr int QS_DELTA = 200;
 constexpr int EVAL_ROUGHNESS = 15;
+// initial half width of the pvs aspiration window, doubled on every fail
+constexpr int ASPIRATION = 50;
+
+// material + piece square terms for each side, carried along with the position
+struct Eval {
+	int side[2];
+
+	// from the point of view of the player to move
+	int rel(int next_player) const {
+		return next_player ? side[1]-side[0] : side[0]-side[1];
+	}
+};
 
 struct SearchState {
 	Position pos;
 	uint64_t hash;
 	int score;
 	int depth;
+	Eval ev;
 	// int buf_i;
 };
 
-struct SearchStateCache {
-	// lo <= optimal score <= hi
-	int lo, hi;
-	SearchStateCache(): lo(LOSING), hi(WINNING) {}
-};
-
-#ifdef BUILD_DEBUG
-template<class V>
-using SearchAlloc = std::allocator<std::pair<uint64_t, V>>;
-#else
-template<class V>
-using SearchAlloc = mi_stl_allocator<std::pair<uint64_t, V>>;
-#endif
-
+// an expanded position: moves, their order, and each child's static score
+// (from the child's point of view). child hashes / evals are redone on make()
 struct Bufs {
 	vec<Move> t1;
 	vec<int> t2;
-	vec<SearchState> t3;
+	vec<int> t3;
+
+	size_t bytes() const {
+		size_t o = sizeof(Bufs) + t1.capacity()*sizeof(Move)
+			+ t2.capacity()*sizeof(int) + t3.capacity()*sizeof(int);
+		for (Move const& move: t1) if (move.delta.big()) o += move.delta.n*sizeof(Change);
+		return o;
+	}
+};
+
+constexpr int MAX_PLY = 128;
+// Frame::cycle when no repetition was found under the node
+constexpr int NO_CYCLE = MAX_PLY+1;
+
+// move ordering: bonuses on top of the static score, and the bound on history values
+constexpr uint32_t NO_KEY = ~uint32_t(0);
+constexpr int KILLER_BONUS = 150;
+constexpr int COUNTER_BONUS = 100;
+constexpr int HISTORY_MAX = 1<<14;
+// captures and promotions sort above every quiet move, by mvv-lva
+constexpr int NOISY_BONUS = WINNING/2;
+
+// one ply of a thread's search stack
+struct Frame {
+	uint64_t hash;
+	Eval ev;
+	int score, depth;
+	// move_key() of the move into this ply, NO_KEY at the root
+	uint32_t key;
+	// reached by a null move / verifying a null move cutoff, no null move from here
+	bool null=false, verify=false;
+	// lowest ply (negative for the game before the root) a repetition under this node
+	// went back to. if it's above the node, the result depends on the path to it
+	int cycle=NO_CYCLE;
+
+	// squares the move into this ply overwrote, and what was on them
+	int n_undo;
+	unsigned char undo_sq[MAX_BOARD_SIZE], undo_pc[MAX_BOARD_SIZE];
+
+	// scratch for expanding / ordering this ply, reused by every node searched at it.
+	// moves is only used by mcts, expand() generates into the cached list itself
+	vec<Move> moves;
+	vec<PosType> status;
+	vec<int> order, order_score;
+};
+
+// a node whose children are searched by several threads (see search.hpp),
+// set once one of them fails high so the rest can give up
+struct Split {
+	std::atomic<bool> cut=false;
+	Split const* parent;
+	// the owner's path to the node, stack[base..ply], then on through parent
+	Frame const* stack;
+	int ply, base;
+
+	Split(Split const* parent_, Frame const* stack_=nullptr, int ply_=0, int base_=0):
+		parent(parent_), stack(stack_), ply(ply_), base(base_) {}
+
+	bool cut_above() const {
+		for (Split const* s=this; s; s=s->parent) {
+			if (s->cut.load(std::memory_order_relaxed)) return true;
+		}
+
+		return false;
+	}
+};
+
+// forward pruning in bound(), each can be switched off. margins are in eval units.
+// null move and probcut only pay off in some games, they're off unless the script
+// opts in (NULL_MOVE / PROBCUT, see specification.lua)
+struct Pruning {
+	// null move: let the opponent move twice at depth-1-null_r, cut if still >= gamma.
+	// from null_verify_depth a cutoff is checked by a reduced search without null moves
+	bool null_move=false;
+	int null_min_depth=3, null_r=2, null_verify_depth=7;
+
+	// late move reductions for quiet moves after the first lmr_min_moves:
+	// lmr_base + log(depth)*log(k)/lmr_div plies, re-searched at full depth if they fail high
+	bool lmr=true;
+	int lmr_min_depth=3, lmr_min_moves=3;
+	double lmr_base=0.75, lmr_div=2.25;
+
+	// futility: skip quiet moves whose static score + margin*depth can't reach gamma
+	bool futility=true;
+	int futility_depth=2, futility_margin=120;
+
+	// reverse futility: cut when the static score beats gamma by margin*depth
+	bool rfp=true;
+	int rfp_depth=3, rfp_margin=150;
+
+	// probcut: a capture holding gamma+margin at depth-probcut_r likely holds gamma at full depth
+	bool probcut=false;
+	int probcut_min_depth=5, probcut_r=4, probcut_margin=200, probcut_tries=3;
+};
+
+// per technique: times it fired, and times its result had to be searched again
+struct PruneStats {
+	struct Count {
+		uint64_t fired=0, research=0;
+	};
+
+	Count null_move, lmr, futility, rfp, probcut;
+};
+
+// per thread search state, bound() makes and unmakes moves on pos in place
+struct Worker {
+	int lua_i;
+	Position pos;
+	vec<Frame> stack;
+	uint64_t nodes=0;
+	// best move found by the last bound() at ply 0, -1 if none
+	int root_move=-1;
+	// innermost split the thread is working under, if any, and the ply its task started at
+	Split const* split=nullptr;
+	int base_ply=0;
+
+	// move ordering tables, indexed by move_key(): two killers per ply,
+	// butterfly history, and the quiet move that last refuted each move
+	vec<std::array<uint32_t,2>> killers;
+	vec<int> history;
+	vec<uint32_t> countermove;
+
+	PruneStats pruned;
+	// types cache probes, per thread so probing shares no counter. summed
+	// for print_depth without syncing, the figure there is approximate
+	uint64_t type_hits=0, type_misses=0;
+
+	Worker(int lua_i_, int n_keys): lua_i(lua_i_), stack(MAX_PLY+1),
+		killers(MAX_PLY+1, {NO_KEY, NO_KEY}), history(n_keys), countermove(n_keys, NO_KEY) {}
+
+	// killers are position specific, history fades
+	void new_search() {
+		std::fill(killers.begin(), killers.end(), std::array<uint32_t,2> {NO_KEY, NO_KEY});
+		for (int& h: history) h/=2;
+		pruned = {};
+	}
+};
+
+// thrown out of bound() once stop is set (out of time, or the main thread is done)
+// or the thread's probe is cancelled, nothing on the way up is written to the cache
+struct SearchAbort {};
+
+// how search() splits the root between threads
+enum class Driver {
+	// every thread runs its own iterative deepening, sharing the tables,
+	// bisecting [LOSING, WINNING] with null window probes at each depth
+	LazySMP,
+	// threads probe different gammas of one shared root window, depth by depth
+	Bisect,
+	// as LazySMP, but each depth is a pvs with an aspiration window around the last score
+	PVS,
+	// as LazySMP, but each depth is mtd(f) starting from the last score
+	MTDF
 };
 
 struct Searcher {
-	int max_pty, n, m, max_depth;
-	vec<vec<uint64_t>> pt_pos_hash;
-	vec<uint64_t> depth_hash;
+	int max_pty, n, m, max_depth, nt;
+	Zobrist zob;
+
+	// piece_weights + pst flattened to piece*nm + square, and which side each piece counts for
+	vec<int> psq;
+	vec<int> psq_side;
 	vec<LuaInterface> interfaces;
-	// vec<vec<Bufs>> tmp;
+	vec<Worker> workers;
 
 	Pool pool;
 	std::string const& lua_path;
-	uint64_t player_hash;
-
-	gtl::parallel_flat_hash_map<uint64_t, int, std::identity,
-		std::equal_to<uint64_t>, SearchAlloc<int>, 6, std::mutex> killer_move;
 
-	gtl::parallel_flat_hash_map<uint64_t, SearchStateCache, std::identity,
-		std::equal_to<uint64_t>, SearchAlloc<SearchStateCache>, 6, std::mutex> cache;
-	
-	gtl::parallel_flat_hash_map<uint64_t, Bufs, std::identity,
-		std::equal_to<uint64_t>, SearchAlloc<Bufs>, 6, std::mutex> pos_c;
+	// default per move budget (ms), and nodes between clock reads in bound()
+	static constexpr int TIME_LIMIT = 10000;
+	static constexpr int TIME_CHECK_NODES = 32;
+	TimeManager tm{TIME_LIMIT};
+	// set when out of time or once the main thread finishes its last iteration.
+	// run() only ever sets it, and clears it once its threads are done. a caller that
+	// sets it from outside clears it again before starting the next search
+	std::atomic<bool> stop=false;
+	// set from outside to end the running search, or the next one if none is running
+	// yet. run() starts stopped while it's set, it stays set until the caller clears it
+	std::atomic<bool> cancelled=false;
+	// per thread, aborts just that thread's probe once its answer no longer matters
+	std::unique_ptr<std::atomic<bool>[]> cancel;
+
+	Driver driver=Driver::LazySMP;
+	Pruning pruning;
+
+	TT cache;
 	
-	Searcher(int max_pty_, int n_, int m_, int max_depth_,
-		int nt_, std::string const& lua_path_):
+	MoveCache<Bufs> pos_c;
+	// expansions this close to the root survive eviction for the rest of the search
+	int protect_ply=4;
 
-		max_pty(max_pty_), n(n_), m(m_), max_depth(max_depth_),
-		pool(nt_), lua_path(lua_path_) {
+	// the script sets MOVE_TAGS, quiescence can go by them
+	bool tagged=false;
 
-		std::mt19937_64 rng(123);
-		player_hash = rng();
+	// get_pos_type results, shared by the threads and kept across searches
+	PosTypeCache types;
 
-		pt_pos_hash.resize(max_pty+1);
-		for (int pt=0; pt<=max_pty; pt++) {
-			pt_pos_hash[pt].resize(n*m);
-			for (int i=0; i<n; i++) for (int j=0; j<m; j++) pt_pos_hash[pt][i*m + j]=rng();
-		}
+	// hashes of the positions played before the root, oldest first
+	vec<uint64_t> game;
+
+	// endgame tables probed below the root, if any
+	TablebaseSet const* tb=nullptr;
+	
+	// nt_ helper threads run lazy smp alongside the caller, each with its own lua state
+	Searcher(int max_pty_, int n_, int m_, int max_depth_,
+		int nt_, std::string const& lua_path_, int tt_mb=64, int pos_c_mb=256, int types_mb=16):
 
-		depth_hash.resize(max_depth+1);
-		for (int i=0; i<=max_depth; i++) {
-			depth_hash[i] = rng();
+		max_pty(max_pty_), n(n_), m(m_), max_depth(max_depth_), nt(nt_),
+		zob(max_pty_, n_*m_), pool(nt_), lua_path(lua_path_), cache(tt_mb), pos_c(pos_c_mb), types(types_mb) {
+
+		psq.assign((max_pty+1)*n*m, 0);
+		psq_side.assign(max_pty+1, -1);
+		for (int pt=1; pt<=std::min(max_pty, 12); pt++) {
+			int k = pt<=6 ? pt-1 : pt-7;
+			psq_side[pt] = pt<=6 ? 0 : 1;
+			for (int x=0; x<n*m; x++) psq[pt*n*m + x] = piece_weights[k] + pst[k][x];
 		}
 
 		for (int i=0; i<=nt_; i++) {
 			interfaces.emplace_back(lua_path);
+			workers.emplace_back(i, (max_pty+1)*n*m*n*m);
 		}
+
+		tagged = interfaces[0].has_tags;
+		pruning.null_move = interfaces[0].null_move_ok;
+		pruning.probcut = interfaces[0].probcut_ok;
+
+		cancel.reset(new std::atomic<bool>[nt+1]());
 	}
 
 	uint64_t hash(Position const& pos) {
-		uint64_t o=0;
-		if (pos.next_player) o^=player_hash;
-		for (int i=0; i<n*m; i++) {
-			o^=pt_pos_hash[pos.board[i]][i];
+		return zob.hash(pos);
+	}
+
+	// lua.get_pos_type(pos) through the types cache
+	PosType pos_type(LuaInterface& lua, Position const& pos) {
+		PosType pty;
+		uint64_t h = hash(pos);
+		if (!types.probe(h, pty)) types.store(h, pty = lua.get_pos_type(pos));
+		return pty;
+	}
+
+	// same for t.pos, h is its hash. counts the probe in t
+	PosType pos_type(Worker& t, uint64_t h) {
+		PosType pty;
+		if (types.probe(h, pty)) {
+			t.type_hits++;
+			return pty;
 		}
 
-		return o;
+		t.type_misses++;
+		types.store(h, pty = interfaces[t.lua_i].get_pos_type(t.pos));
+		return pty;
 	}
 
-	void change(SearchState& state, Move& move) {
-		state.hash=state.pos.next_player ? player_hash : 0;
-		
-		std::swap(move.board, state.pos.board);
-		for (int i=0; i<n*m; i++) state.hash^=pt_pos_hash[state.pos.board[i]][i];
+	// exact score of t.pos from the tables, mates further away score lower
+	bool probe_tb(Worker& t, int& score) {
+		if (!tb) return false;
+
+		PosType pty;
+		int dtm;
+		if (!tb->probe(t.pos, n*m, pty, dtm)) return false;
+
+		score = pty==PosType::Win ? WINNING-dtm : pty==PosType::Loss ? LOSING+dtm : 0;
+		return true;
+	}
+
+	// the game so far, repeating any of these positions in the search is a draw
+	void set_game(vec<Position> const& history) {
+		game.clear();
+		for (Position const& p: history) game.push_back(hash(p));
+	}
+
+	// whether the position at ply is already on the path from the root (including other
+	// threads' part of it, through the splits) or in the game before it. a hit sets
+	// the frame's cycle to the ply it repeats. null moves break the path
+	bool repeated(Worker& t, int ply) {
+		Frame& f = t.stack[ply];
+		if (f.null) return false;
+
+		Frame const* st = t.stack.data();
+		Split const* s = t.split;
+		// off: ply of st[0] in t's numbering
+		int x=ply-1, base=t.base_ply, off=0;
+		while (true) {
+			for (; x>=base; x--) {
+				if (st[x].hash==f.hash) {
+					f.cycle = off+x;
+					return true;
+				}
+
+				if (st[x].null) return false;
+			}
+
+			if (!s) break;
+			off += base-1 - s->ply;
+			st = s->stack, x = s->ply, base = s->base;
+			s = s->parent;
+		}
+
+		int gp = off+base-1;
+		for (int k=int(game.size())-1; k>=0; k--, gp--) {
+			if (game[k]==f.hash) {
+				f.cycle = gp;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void change(SearchState& state, Move const& move) {
+		state.hash = zob.update(state.hash^zob.player, state.pos.board, move.delta);
+		eval_update(state.ev, state.pos.board, move.delta);
+		move.delta.apply(state.pos.board);
 
 		state.pos.next_player^=1;
-		state.score = score(state.pos); //FIXME: optimize when replace with nnue
+		state.score = state.ev.rel(state.pos.next_player); //FIXME: replace with nnue
+	}
+
+	Eval eval(Position const& pos) {
+		Eval o {};
+		for (int x=0; x<n*m; x++) {
+			int pt = pos.board[x];
+			if (psq_side[pt]>=0) o.side[psq_side[pt]] += psq[pt*n*m + x];
+		}
+
+		return o;
+	}
+
+	// ev is for board, moves it to after d
+	void eval_update(Eval& ev, unsigned char const* board, MoveDelta const& d) {
+		for (Change c: d) {
+			int x = c.sq, from = board[x], to = c.piece;
+			if (psq_side[from]>=0) ev.side[psq_side[from]] -= psq[from*n*m + x];
+			if (psq_side[to]>=0) ev.side[psq_side[to]] += psq[to*n*m + x];
+		}
 	}
 
 	int score(Position const& pos) {
@@ -186,161 +477,876 @@ struct Searcher {
 		return pos.next_player ? o2-o1 : o1-o2;
 	}
 
-	// ab with [gamma, gamma+1]
+	// (piece, from, to) of a move from pos, what the ordering tables are indexed by
+	uint32_t move_key(Position const& pos, Move const& move) const {
+		int nm = n*m;
+		int from = std::min(move.from.i*m + move.from.j, nm-1);
+		int to = std::min(move.to.i*m + move.to.j, nm-1);
+		int pt = pos.board[from] ? pos.board[from] : move.delta.after(pos.board, to);
+		return (uint32_t(pt)*nm + from)*nm + to;
+	}
+
+	// 1 (pawn) to 6 (king) for the chess pieces, 1 for anything else
+	static int piece_rank(int pt) {
+		return pt>=1 && pt<=12 ? (pt-1)%6+1 : 1;
+	}
+
+	// most valuable victim / least valuable attacker, promotions count as taking the new piece
+	int mvv_lva(Position const& pos, Move const& move) const {
+		int nm = n*m;
+		int from = std::min(move.from.i*m + move.from.j, nm-1);
+		int to = std::min(move.to.i*m + move.to.j, nm-1);
+
+		int o = -piece_rank(pos.board[from]);
+		if (move.tags&TAG_CAPTURE) o += 8*piece_rank(move.captured);
+		if (move.tags&TAG_PROMOTION) o += 8*(piece_rank(move.delta.after(pos.board, to))-1);
+		return o;
+	}
+
+	// moves searched at all here: captures and promotions in quiescence (depth 0) if the
+	// script tags its moves, otherwise those whose static score stays above min_score
+	bool searchable(Frame const& f, Bufs const& b, int i, int min_score) const {
+		if (f.depth || !tagged) return -b.t3[i] >= min_score;
+		return (b.t1[i].tags&TAG_NOISY) != 0;
+	}
+
+	// fills the ply's order with the moves worth searching: the hash move, then
+	// captures and promotions by mvv-lva, then quiet moves by static score adjusted
+	// by killers, the countermove and history. moves ending the game come first
+	void order_moves(Worker& t, int ply, Bufs const& b, int hash_i, int min_score) {
+		Frame& f = t.stack[ply];
+		f.order.clear();
+		if (hash_i!=-1) f.order.push_back(hash_i);
+
+		for (int i: b.t2) {
+			if (i!=hash_i && searchable(f, b, i, min_score)) f.order.push_back(i);
+		}
+
+		auto const& killers = t.killers[ply];
+		uint32_t counter = f.key==NO_KEY ? NO_KEY : t.countermove[f.key];
+
+		f.order_score.resize(b.t1.size());
+		for (int i: f.order) {
+			Move const& mv = b.t1[i];
+			int s;
+			if (b.t3[i]==LOSING) {
+				s = WINNING;
+			} else if (mv.tags&TAG_NOISY) {
+				s = NOISY_BONUS + mvv_lva(t.pos, mv);
+			} else {
+				uint32_t k = move_key(t.pos, mv);
+				s = -b.t3[i] + t.history[k]*64/HISTORY_MAX;
+				if (k==killers[0] || k==killers[1]) s+=KILLER_BONUS;
+				else if (k==counter) s+=COUNTER_BONUS;
+			}
+			f.order_score[i]=s;
+		}
+
+		std::stable_sort(f.order.begin() + (hash_i!=-1), f.order.end(),
+			[&s=f.order_score](int x, int y){
+				return s[x] > s[y];
+			}
+		);
+	}
+
+	// move i failed high at ply after the moves in tried didn't. only quiet moves
+	// go in the tables, captures already sort first by mvv-lva
+	void update_order(Worker& t, int ply, Bufs const& b, int i, std::span<int const> tried) {
+		Frame& f = t.stack[ply];
+		auto quiet = [&](int j) { return !(b.t1[j].tags&(TAG_NOISY|TAG_CHECK)); };
+		if (f.depth<1 || !quiet(i)) return;
+
+		uint32_t k = move_key(t.pos, b.t1[i]);
+		auto& killers = t.killers[ply];
+		if (killers[0]!=k) killers[1]=killers[0], killers[0]=k;
+		if (f.key!=NO_KEY) t.countermove[f.key]=k;
+
+		// moves toward +-HISTORY_MAX, slower the closer it gets
+		int bonus = std::min(f.depth*f.depth, 400);
+		auto add = [&t](uint32_t key, int v) {
+			int& h = t.history[key];
+			h += v - h*std::abs(v)/HISTORY_MAX;
+		};
+
+		add(k, bonus);
+		for (int j: tried) if (quiet(j)) add(move_key(t.pos, b.t1[j]), -bonus);
+	}
+
+	// plays move from ply onto t.pos, filling in ply+1
+	void make(Worker& t, int ply, Move const& move) {
+		Frame& f = t.stack[ply];
+		Frame& c = t.stack[ply+1];
+
+		MoveDelta const& d = move.delta;
+		c.hash = zob.update(f.hash^zob.player, t.pos.board, d);
+		c.ev = f.ev;
+		eval_update(c.ev, t.pos.board, d);
+		c.key = move_key(t.pos, move);
+		c.null=false, c.verify=false;
+		c.depth = f.depth-1;
+
+		c.n_undo = 0;
+		for (Change ch: d) {
+			c.undo_sq[c.n_undo] = ch.sq;
+			c.undo_pc[c.n_undo++] = t.pos.board[ch.sq];
+			t.pos.board[ch.sq] = ch.piece;
+		}
+
+		t.pos.next_player^=1;
+		c.score = c.ev.rel(t.pos.next_player);
+
+#ifdef BUILD_DEBUG
+		assert(c.score==score(t.pos) && c.hash==hash(t.pos));
+#endif
+	}
+
+	// passes the move to the other player, searching depth-1-r
+	void make_null(Worker& t, int ply, int r) {
+		Frame& f = t.stack[ply];
+		Frame& c = t.stack[ply+1];
+
+		c.hash = f.hash^zob.player;
+		c.ev = f.ev;
+		c.depth = std::max(f.depth-1-r, 0);
+		c.key = NO_KEY;
+		c.null=true, c.verify=false;
+		c.n_undo = 0;
+
+		t.pos.next_player^=1;
+		c.score = c.ev.rel(t.pos.next_player);
+	}
+
+	void unmake(Worker& t, int ply) {
+		Frame& c = t.stack[ply+1];
+		for (int k=0; k<c.n_undo; k++) t.pos.board[c.undo_sq[k]] = c.undo_pc[k];
+		t.pos.next_player^=1;
+	}
+
+	// static score of the child after move, from the child's point of view.
+	// pty is its get_pos_type, if known already, and goes into the types cache
+	int child_score(Worker& t, int ply, Move const& move, std::optional<PosType> pty={}) {
+		make(t, ply, move);
+
+		if (!pty) pty = pos_type(t, t.stack[ply+1].hash);
+		else types.store(t.stack[ply+1].hash, *pty);
+		int o = t.stack[ply+1].score;
+		if (pty==PosType::Win) o = WINNING;
+		else if (pty==PosType::Loss) o = LOSING;
+		else if (pty==PosType::Draw) o = 0;
+
+		unmake(t, ply);
+		return o;
+	}
+
+	// generates moves into the ply's scratch, scores each child in place
+	std::shared_ptr<Bufs const> expand(Worker& t, int ply, bool protect) {
+		Frame& f = t.stack[ply];
+
+		// the children's types come with the moves when the script can give them,
+		// otherwise child_score looks each one up in the types cache. the moves go
+		// straight into the list the move cache keeps
+		auto& lua = interfaces[t.lua_i];
+		Bufs b;
+		f.status.clear();
+		if (lua.has_status) lua.moves_with_status(b.t1, f.status, t.pos);
+		else lua.valid_moves(b.t1, t.pos);
+
+		b.t3.resize(b.t1.size());
+		for (int i=0; i<b.t1.size(); i++) {
+			b.t3[i] = f.status.empty() ? child_score(t, ply, b.t1[i]) : child_score(t, ply, b.t1[i], f.status[i]);
+		}
+
+		sort_bufs(b);
+		return pos_c.insert(f.hash, std::move(b), protect);
+	}
+
+	// fills in t2, children by static score
+	void sort_bufs(Bufs& b) {
+		b.t2.resize(b.t1.size());
+		std::iota(b.t2.begin(), b.t2.end(), 0);
+		std::sort(b.t2.begin(), b.t2.end(),
+			[&t3=b.t3](int x, int y){
+				return t3[x] < t3[y];
+			}
+		);
+	}
+
+	// repetitions under the child at ply+1 are under the node at ply too
+	static void add_cycle(Worker& t, int ply) {
+		t.stack[ply].cycle = std::min(t.stack[ply].cycle, t.stack[ply+1].cycle);
+	}
+
+	// ab with [gamma, gamma+1] on t.pos, described by t.stack[ply]
 	// fails low: <gamma
 	// fails high: >=gamma+1
-	int bound(int lua_i, SearchState s, int gamma) {
-		std::cerr << "bound " << s.depth << ' ' << s.score << ' ' << gamma << '\n';
+	int bound(Worker& t, int ply, int gamma) {
+		if (++t.nodes%TIME_CHECK_NODES==0) {
+			if (tm.hard_expired()) stop=true;
+			if (t.split && t.split->cut_above()) throw SearchAbort();
+		}
+		if (stop.load(std::memory_order_relaxed) || cancel[t.lua_i].load(std::memory_order_relaxed))
+			throw SearchAbort();
 
-		if (s.depth<0) s.depth=0;
+		Frame& f = t.stack[ply];
+		f.cycle = NO_CYCLE;
+		if (f.depth<0) f.depth=0;
+		if (ply>=MAX_PLY) return f.score;
+
+		// a repetition is a draw, whatever the tt says about the position
+		if (ply && repeated(t, ply)) return 0;
+
+		int tb_score;
+		if (ply && probe_tb(t, tb_score)) return tb_score;
 
 		int best=LOSING, best_move_i=-1;
 
-		uint64_t k = s.hash^depth_hash[s.depth];
+		// deeper results are good enough for this depth
+		TTData tte{};
+		bool tt_hit = cache.probe(f.hash, tte);
+		if (tt_hit && tte.depth>=f.depth) {
+			if (!ply) t.root_move=tte.move_i; // in case this cuts off
+			if (tte.lo>=gamma) return tte.lo;
+			else if (tte.hi<gamma) return tte.hi;
+		}
 
-		SearchStateCache cache_v = cache[k];
-		if (cache_v.lo>=gamma) return cache_v.lo;
-		else if (cache_v.hi<gamma) return cache_v.hi;
+		if (f.depth==0) best=std::max(best, f.score);
 
-		if (best_move_i!=-1) return best;
+		Pruning const& pr = pruning;
+		bool can_prune = ply>0 && f.score<WINNING && f.score>LOSING;
 
-		if (s.depth==0) best=std::max(best, s.score);
+		// reverse futility
+		if (pr.rfp && can_prune && f.depth>0 && f.depth<=pr.rfp_depth
+			&& f.score - pr.rfp_margin*f.depth >= gamma) {
+			t.pruned.rfp.fired++;
+			return f.score;
+		}
 
-		int killer_i=-1;
+		// null move, before spending a lua call on the moves
+		if (pr.null_move && can_prune && !f.null && !f.verify
+			&& f.depth>=pr.null_min_depth && f.score>=gamma) {
+			make_null(t, ply, pr.null_r);
+			int nv = -bound(t, ply+1, 1-gamma);
+			unmake(t, ply);
+			add_cycle(t, ply);
+
+			if (nv>=gamma) {
+				t.pruned.null_move.fired++;
+				if (f.depth<pr.null_verify_depth) return nv;
+
+				int cyc = f.cycle;
+				f.depth-=pr.null_r, f.verify=true;
+				int vv = bound(t, ply, gamma);
+				f.depth+=pr.null_r, f.verify=false;
+				f.cycle = std::min(f.cycle, cyc);
+
+				if (vv>=gamma) return vv;
+				t.pruned.null_move.research++;
+			}
+		}
 
-		auto it = killer_move.find(s.hash);
-		if (it==killer_move.end() && s.depth>=3) {
-			s.depth-=3;
-			bound(lua_i, s, gamma);
-			s.depth+=3;
+		int hash_i = tt_hit ? tte.move_i : -1;
+		if (f.depth>=3 && hash_i==-1) {
+			int cyc = f.cycle;
+			f.depth-=3;
+			bound(t, ply, gamma);
+			f.depth+=3;
+			f.cycle = std::min(f.cycle, cyc);
 
-			assert(killer_move.contains(s.hash));
-			killer_i = killer_move[s.hash];
-		} else if (s.depth>=3) {
-			killer_i = it->second;
+			if (cache.probe(f.hash, tte)) hash_i=tte.move_i;
 		}
 
-		int min_score = QS - QS_A*s.depth + s.score;
-		
-		auto pos_it = pos_c.find(s.hash);
-		if (pos_it==pos_c.end()) {
-			Bufs b;
-			interfaces[lua_i].valid_moves(b.t1, s.pos);
+		int min_score = QS - QS_A*f.depth + f.score;
 
-			for (Move& move: b.t1) {
-				SearchState& val = b.t3.emplace_back(SearchState {
-					.pos=Position {.next_player=!s.pos.next_player},
-					.depth = s.depth-1,
-					// .buf_i=s.buf_i+1
-				});
+		auto ret = [&]() {
+			// a bound that leans on a repetition above this node only holds on this path
+			if (f.cycle>=ply) {
+				if (best<gamma) cache.store(f.hash, f.depth, LOSING, best, best_move_i);
+				else cache.store(f.hash, f.depth, best, WINNING, best_move_i);
+			}
 
-				std::copy(move.board, move.board+n*m, val.pos.board);
-				val.hash = hash(val.pos);
-				
-				auto pty = interfaces[lua_i].get_pos_type(val.pos);
+			if (!ply) t.root_move=best_move_i;
+			return best;
+		};
 
-				if (pty==PosType::Win) val.score = WINNING;
-				else if (pty==PosType::Loss) val.score = LOSING;
-				else if (pty==PosType::Draw) val.score = 0;
-				else val.score = score(val.pos);
+		if (best>=gamma) return ret();
+
+		auto quiet = [&](Bufs const& b, int i) { return !(b.t1[i].tags&(TAG_NOISY|TAG_CHECK)); };
+
+		// searches move i, the k-th tried here, with futility and lmr. true on a cutoff
+		auto try_move = [&](Bufs const& b, int i, int k) {
+			bool late_quiet = k>0 && i!=hash_i && quiet(b, i);
+
+			// delta pruning, quiescence's futility
+			int dv = -b.t3[i] + QS_DELTA;
+			if (!f.depth && i!=hash_i && dv<gamma) {
+				best = std::max(best, dv);
+				return false;
 			}
 
-			b.t2.resize(b.t1.size());
-			std::iota(b.t2.begin(), b.t2.end(), 0);
-			std::sort(b.t2.begin(), b.t2.end(),
-				[&t3=b.t3](int x, int y){
-					return t3[x].score < t3[y].score;
+			// futility, the child's static score is as good as it gets
+			int fv = -b.t3[i] + pr.futility_margin*f.depth;
+			if (pr.futility && late_quiet && f.depth<=pr.futility_depth && fv<gamma) {
+				t.pruned.futility.fired++;
+				best = std::max(best, fv);
+				return false;
+			}
+
+			make(t, ply, b.t1[i]);
+			Frame& c = t.stack[ply+1];
+			c.score = b.t3[i];
+
+			int r=0;
+			if (pr.lmr && late_quiet && f.depth>=pr.lmr_min_depth && k>=pr.lmr_min_moves) {
+				r = std::clamp(int(pr.lmr_base + std::log(f.depth)*std::log(k)/pr.lmr_div), 0, f.depth-2);
+			}
+
+			c.depth = f.depth-1-r;
+			int nv = -bound(t, ply+1, 1-gamma);
+			add_cycle(t, ply);
+			if (r) {
+				t.pruned.lmr.fired++;
+				if (nv>=gamma) {
+					t.pruned.lmr.research++;
+					c.depth = f.depth-1;
+					nv = -bound(t, ply+1, 1-gamma);
+					add_cycle(t, ply);
 				}
-			);
+			}
 
-			pos_it = pos_c.emplace(s.hash, std::move(b)).first;
-		}
+			unmake(t, ply);
 
-		auto ret = [&]() {
-			cache.emplace(k, SearchStateCache());
+			if (nv>best) best=nv, best_move_i=i;
+			if (best<gamma) return false;
 
-			cache.modify_if(k, [best,gamma](std::pair<const uint64_t,SearchStateCache>& kv){
-				auto& v = kv.second;
-				if (best<gamma) v.hi = best;
-				else v.lo = best;
-			});
+			update_order(t, ply, b, i, std::span<int const>(f.order.data(), k));
+			return true;
+		};
+
+		bool protect = ply<protect_ply;
+		auto bufs = pos_c.find(f.hash, protect);
+
+		// not expanded yet: pull moves from the script one at a time and search each as
+		// it comes, a cutoff saves generating and scoring the rest. only a complete list is
+		// cached. quiescence is left to expand(), it picks captures out of the whole list
+		auto& lua = interfaces[t.lua_i];
+		if (!bufs && lua.has_moves_iter && f.depth>0) {
+			auto it = lua.moves_iter(t.pos);
+			Bufs lb;
+			auto pull = [&]() {
+				Move& mv = lb.t1.emplace_back();
+				if (!it.next(mv)) {
+					lb.t1.pop_back();
+					return false;
+				}
+
+				lb.t3.push_back(child_score(t, ply, mv));
+				return true;
+			};
 
-			if (best_move_i!=-1) {
-				killer_move.insert_or_assign(s.hash, best_move_i);
+			f.order.clear();
+			if (hash_i!=-1) {
+				while (int(lb.t1.size())<=hash_i && pull());
+				if (hash_i>=int(lb.t1.size()) || !searchable(f, lb, hash_i, min_score)) hash_i=-1;
+			}
+
+			if (hash_i!=-1) {
+				f.order.push_back(hash_i);
+				if (try_move(lb, hash_i, 0)) return ret();
 			}
-		};
 
-		if (best>=gamma) {ret(); return best;}
+			// the rest in the order the script yields them
+			for (int i=0; i<lb.t1.size() || pull(); i++) {
+				if (i==hash_i || !searchable(f, lb, i, min_score)) continue;
 
-		auto& b = pos_it->second;
-		bool inc_killer = killer_i!=-1 && -b.t3[killer_i].score >= min_score;
-		assert(killer_i>=-1 && killer_i<int(b.t1.size()));
-		for (int j=inc_killer ? -1 : 0; j<b.t1.size(); j++) {
-			int i = j==-1 ? killer_i : b.t2[j];
-			assert(i>=0 && i<b.t1.size());
-			if (j>=0 && i==killer_i) continue;
+				int k = f.order.size();
+				f.order.push_back(i);
+				if (try_move(lb, i, k)) return ret();
+			}
 
-			if (j>=0 && -b.t3[i].score < min_score) break;
+			sort_bufs(lb);
+			pos_c.insert(f.hash, std::move(lb), protect);
+			return ret();
+		}
 
-			if (j>=0 && s.depth<=1 && b.t3[i].score >= 1-gamma && -b.t3[i].score>best) {
-				best=-b.t3[i].score;
-				best_move_i=i;
+		if (!bufs) bufs = expand(t, ply, protect);
+		auto& b = *bufs;
+
+		// probcut: the best few captures already at gamma statically, at reduced depth
+		if (pr.probcut && can_prune && !f.null && f.depth>=pr.probcut_min_depth) {
+			int pc_gamma = gamma + pr.probcut_margin;
+			int tries = 0;
+			for (int i: b.t2) {
+				if (-b.t3[i] < gamma || tries==pr.probcut_tries) break;
+				if (quiet(b, i)) continue;
+				tries++;
+
+				make(t, ply, b.t1[i]);
+				t.stack[ply+1].score = b.t3[i];
+				t.stack[ply+1].depth = f.depth-1-pr.probcut_r;
+				int nv = -bound(t, ply+1, 1-pc_gamma);
+				unmake(t, ply);
+				add_cycle(t, ply);
+
+				if (nv>=pc_gamma) {
+					t.pruned.probcut.fired++;
+					if (f.cycle>=ply) cache.store(f.hash, f.depth-pr.probcut_r, nv, WINNING, i);
+					return nv;
+				}
 
-				break;
+				t.pruned.probcut.research++;
 			}
+		}
 
-			int nv = -bound(lua_i, b.t3[i], 1-gamma);
-			if (nv>best) best=nv, best_move_i=i;
+		if (hash_i>=int(b.t1.size())) hash_i=-1; // stale move from a hash collision
+		if (hash_i!=-1 && !searchable(f, b, hash_i, min_score)) hash_i=-1;
+		order_moves(t, ply, b, hash_i, min_score);
 
-			if (best>=gamma) {ret(); return best;}
+		for (int k=0; k<f.order.size(); k++) {
+			if (try_move(b, f.order[k], k)) break;
 		}
 
-		ret();
-		return best;
+		return ret();
 	}
 
 	struct SearchOut {
 		PosType pos_type;
 		vec<Move> possible;
 		int move_i=-1;
+		// per completed depth: ms since the start of the search, root probes it took,
+		// and nodes searched so far by whoever drives the root
+		vec<int64_t> depth_ms;
+		vec<int> depth_probes;
+		vec<uint64_t> depth_nodes;
+
+		void record(int64_t ms, int probes, uint64_t nodes) {
+			depth_ms.push_back(ms);
+			depth_probes.push_back(probes);
+			depth_nodes.push_back(nodes);
+		}
 	};
 
-	static constexpr int TIME_LIMIT = 10000;
-	SearchOut search(Position const& current) {
-		auto start = std::chrono::steady_clock::now();
-		bool tle=false;
+	// alpha-beta on (alpha, beta) for the pv: the first move gets the full window,
+	// the rest a null window through bound(), searched again if they land inside it
+	int pvs(Worker& t, int ply, int alpha, int beta) {
+		if (beta-alpha<=1) return bound(t, ply, beta);
+		if (stop.load(std::memory_order_relaxed)) throw SearchAbort();
+		t.nodes++;
+
+		Frame& f = t.stack[ply];
+		f.cycle = NO_CYCLE;
+		if (f.depth<0) f.depth=0;
+		if (ply>=MAX_PLY) return f.score;
+
+		if (ply && repeated(t, ply)) return 0;
+
+		int tb_score;
+		if (ply && probe_tb(t, tb_score)) return tb_score;
+
+		TTData tte{};
+		bool tt_hit = cache.probe(f.hash, tte);
+		if (tt_hit && tte.depth>=f.depth) {
+			if (!ply) t.root_move=tte.move_i; // in case this cuts off
+			if (tte.lo>=beta) return tte.lo;
+			if (tte.hi<=alpha) return tte.hi;
+			if (tte.lo==tte.hi) return tte.lo;
+		}
+
+		int hash_i = tt_hit ? tte.move_i : -1;
+		if (f.depth>=3 && hash_i==-1) {
+			int cyc = f.cycle;
+			f.depth-=3;
+			pvs(t, ply, alpha, beta);
+			f.depth+=3;
+			f.cycle = std::min(f.cycle, cyc);
+
+			hash_i = tt_move(f.hash);
+		}
+
+		int best=LOSING, best_move_i=-1, alpha0=alpha;
+		auto ret = [&]() {
+			if (f.cycle>=ply) {
+				if (best<=alpha0) cache.store(f.hash, f.depth, LOSING, best, best_move_i);
+				else if (best>=beta) cache.store(f.hash, f.depth, best, WINNING, best_move_i);
+				else cache.store(f.hash, f.depth, best, best, best_move_i);
+			}
+
+			if (!ply) t.root_move=best_move_i;
+			return best;
+		};
+
+		if (f.depth==0) {
+			best = f.score;
+			if (best>=beta) return ret();
+			alpha = std::max(alpha, best);
+		}
+
+		int min_score = QS - QS_A*f.depth + f.score;
+
+		bool protect = ply<protect_ply;
+		auto bufs = pos_c.find(f.hash, protect);
+		if (!bufs) bufs = expand(t, ply, protect);
+
+		auto& b = *bufs;
+		if (hash_i>=int(b.t1.size())) hash_i=-1;
+		if (hash_i!=-1 && !searchable(f, b, hash_i, min_score)) hash_i=-1;
+		order_moves(t, ply, b, hash_i, min_score);
+
+		for (int k=0; k<f.order.size(); k++) {
+			int i = f.order[k];
+
+			make(t, ply, b.t1[i]);
+			t.stack[ply+1].score = b.t3[i];
+
+			int nv;
+			if (k==0) {
+				nv = -pvs(t, ply+1, -beta, -alpha);
+			} else {
+				nv = -bound(t, ply+1, -alpha);
+				add_cycle(t, ply);
+				if (nv>alpha && nv<beta) nv = -pvs(t, ply+1, -beta, -alpha);
+			}
+
+			add_cycle(t, ply);
+			unmake(t, ply);
+
+			if (nv>best) best=nv, best_move_i=i;
+			alpha = std::max(alpha, best);
+
+			if (best>=beta) {
+				update_order(t, ply, b, i, std::span<int const>(f.order.data(), k));
+				break;
+			}
+		}
+
+		return ret();
+	}
+
+	// bisection of [LOSING, WINNING] down to EVAL_ROUGHNESS, helpers probe off-center
+	int bisection(Worker& t, int& move_i, int& probes) {
+		int lo=LOSING, hi=WINNING;
+		while (hi-lo > EVAL_ROUGHNESS) {
+			int mid = (hi+lo+1)/2;
+			if (t.lua_i) mid = lo + 1 + (hi-lo-1)*(t.lua_i%3+1)/4;
+
+			t.root_move = -1;
+			auto ret = bound(t, 0, mid);
+			probes++;
+
+			if (ret >= mid) lo=mid, move_i=t.root_move;
+			else hi=mid-1;
+		}
+
+		return lo;
+	}
+
+	// pvs in a window around the last score, widened on whichever side it fails
+	int aspiration(Worker& t, int prev, int& move_i, int& probes) {
+		int delta = ASPIRATION;
+		int alpha = std::max(prev-delta, LOSING-1), beta = std::min(prev+delta, WINNING+1);
+
+		while (true) {
+			t.root_move = -1;
+			int v = pvs(t, 0, alpha, beta);
+			probes++;
+
+			if (v>alpha && t.root_move!=-1) move_i=t.root_move;
+
+			if (v<=alpha && alpha>=LOSING) alpha = std::max(v-delta, LOSING-1);
+			else if (v>=beta && beta<=WINNING) beta = std::min(v+delta, WINNING+1);
+			else return v;
+
+			delta*=2;
+		}
+	}
+
+	// mtd(f): null window probes from the last score, each next to the bound just found.
+	// steps double while the score keeps moving the same way
+	int mtdf(Worker& t, int g, int& move_i, int& probes) {
+		int lo=LOSING, hi=WINNING, step=1, last=0;
+		while (hi-lo > EVAL_ROUGHNESS) {
+			int gamma = std::clamp(g, lo+1, hi);
+
+			t.root_move = -1;
+			int v = bound(t, 0, gamma);
+			probes++;
+
+			int dir = v>=gamma ? 1 : -1;
+			if (dir>0) {
+				lo = v;
+				if (t.root_move!=-1) move_i=t.root_move;
+			} else {
+				hi = v;
+			}
+
+			step = dir==last ? step*2 : 1;
+			last = dir;
+			g = dir>0 ? lo+step : hi-step+1;
+		}
+
+		return last>0 ? lo : hi;
+	}
+
+	void print_pruning() {
+		PruneStats sum;
+		for (Worker const& t: workers) {
+			auto add = [](PruneStats::Count& a, PruneStats::Count const& x) {
+				a.fired+=x.fired, a.research+=x.research;
+			};
+
+			add(sum.null_move, t.pruned.null_move);
+			add(sum.lmr, t.pruned.lmr);
+			add(sum.futility, t.pruned.futility);
+			add(sum.rfp, t.pruned.rfp);
+			add(sum.probcut, t.pruned.probcut);
+		}
+
+		auto show = [](char const* name, PruneStats::Count const& c) {
+			std::cerr<<" "<<name<<" "<<c.fired<<"/"<<c.research;
+		};
+
+		std::cerr<<"pruning (fired/re-searched):";
+		show("null", sum.null_move);
+		show("lmr", sum.lmr);
+		show("futility", sum.futility);
+		show("rfp", sum.rfp);
+		show("probcut", sum.probcut);
+		std::cerr<<std::endl;
+	}
+
+	void print_depth(int depth) {
+		uint64_t hits=0, misses=0;
+		for (Worker const& t: workers) hits+=t.type_hits, misses+=t.type_misses;
+		int rate = hits+misses ? int(100*hits/(hits+misses)) : 0;
+
+		std::cerr<<"depth "<<depth<<", "<<tm.elapsed()<<"ms, hashfull "<<cache.hashfull()
+			<<", move cache "<<(pos_c.bytes()>>20)<<"MB hits "<<pos_c.hits
+			<<" misses "<<pos_c.misses<<" evictions "<<pos_c.evictions
+			<<", types hits "<<hits<<" ("<<rate<<"%)"<<std::endl;
+	}
+
+	// iterative deepening, run by every thread. helpers (lua_i>0) skip every other
+	// depth depending on their index (and bisect off-center), so they fill the cache
+	// ahead of / around the main thread. the next depth starts from the last score.
+	// move_i only changes once an iteration completes, an abort keeps the last one
+	void iterate(Worker& t, SearchState const& init, SearchOut& out) {
+		int lua_i = t.lua_i;
+		t.pos = init.pos;
+		t.nodes = 0;
+
+		Frame& root = t.stack[0];
+		root.hash=init.hash, root.ev=init.ev, root.score=init.score, root.key=NO_KEY;
+
+		int prev = init.score;
+		for (int depth=1; depth<=max_depth; depth++) {
+			if (!lua_i && depth>1 && tm.soft_expired()) break;
+			if (lua_i && depth>1 && (depth+lua_i)%2==0) continue;
+
+			root.depth=depth;
+			if (!lua_i) print_depth(depth);
+
+			int move_i=-1, probes=0;
+			if (driver==Driver::PVS) prev = aspiration(t, prev, move_i, probes);
+			else if (driver==Driver::MTDF) prev = mtdf(t, prev, move_i, probes);
+			else prev = bisection(t, move_i, probes);
+
+			if (lua_i) continue;
+			out.move_i = move_i!=-1 ? move_i : tt_move(init.hash);
+			out.record(tm.elapsed(), probes, t.nodes);
+		}
+	}
+
+	static constexpr int NO_PROBE = LOSING-1;
+
+	// the root window for Driver::Bisect, shared by all threads
+	struct Window {
+		std::mutex mut;
+		// a probe finished or the search is over, idle threads look for a gamma again
+		std::condition_variable changed;
+		int depth=1, lo=LOSING, hi=WINNING;
+		// move from the fail high that set lo, -1 if none yet
+		int move_i=-1;
+		// gamma each thread is probing, or NO_PROBE
+		vec<int> probing;
+		// probes finished at this depth, nodes over all probes
+		int probes=0;
+		uint64_t nodes=0;
+	};
+
+	// splits the largest gap between lo, the gammas in flight and hi,
+	// NO_PROBE if every gamma in the window is taken
+	int pick_gamma(Window const& w) {
+		vec<int> pts {w.lo};
+		for (int g: w.probing) if (g>w.lo && g<=w.hi) pts.push_back(g);
+		pts.push_back(w.hi+1);
+		std::sort(pts.begin(), pts.end());
+
+		int gamma=NO_PROBE, gap=1;
+		for (int k=0; k+1<pts.size(); k++) {
+			if (pts[k+1]-pts[k] > gap) gap=pts[k+1]-pts[k], gamma=(pts[k]+pts[k+1])/2;
+		}
+
+		return gamma;
+	}
+
+	// iterative deepening where each depth's bisection runs its probes concurrently.
+	// a result narrows the window if its gamma is still inside it, probes the window
+	// has moved past are cancelled. whichever thread closes the window starts the next depth
+	void bisect(Worker& t, SearchState const& init, Window& w, SearchOut& out) {
+		int lua_i = t.lua_i;
+		t.nodes = 0;
+
+		Frame& root = t.stack[0];
+		root.hash=init.hash, root.ev=init.ev, root.score=init.score, root.key=NO_KEY;
+		if (!lua_i) print_depth(1);
+
+		// the loop only ends once the search does, however it leaves it must not strand
+		// threads waiting for a gamma. taking the mutex orders this before their next wait
+		struct Leave {
+			Searcher& s;
+			Window& w;
+			~Leave() {
+				s.stop=true;
+				{ std::scoped_lock l(w.mut); }
+				w.changed.notify_all();
+			}
+		} leave {*this, w};
+
+		std::unique_lock lock(w.mut);
+		while (!stop) {
+			if (w.hi-w.lo <= EVAL_ROUGHNESS) {
+				out.move_i = w.move_i!=-1 ? w.move_i : tt_move(init.hash);
+				out.record(tm.elapsed(), w.probes, w.nodes);
+
+				for (int i=0; i<=nt; i++) if (w.probing[i]!=NO_PROBE) cancel[i]=true;
+
+				if (w.depth>=max_depth || tm.soft_expired()) {
+					stop=true;
+					break;
+				}
+
+				w.depth++, w.lo=LOSING, w.hi=WINNING, w.move_i=-1, w.probes=0;
+				print_depth(w.depth);
+			}
+
+			int gamma = pick_gamma(w);
+			if (gamma==NO_PROBE) {
+				w.changed.wait(lock);
+				continue;
+			}
+
+			int depth = w.depth;
+			w.probing[lua_i]=gamma;
+			cancel[lua_i]=false;
+			lock.unlock();
+
+			t.pos = init.pos;
+			root.depth = depth;
+			t.root_move = -1;
+			uint64_t nodes0 = t.nodes;
+
+			bool done=true;
+			int ret=0;
+			try {
+				ret = bound(t, 0, gamma);
+			} catch (SearchAbort&) {
+				if (stop) throw;
+				done=false;
+			}
+
+			lock.lock();
+			w.probing[lua_i]=NO_PROBE;
+			w.changed.notify_all();
+			w.nodes += t.nodes-nodes0;
+			if (done && depth==w.depth) w.probes++;
+			if (!done || depth!=w.depth || gamma<=w.lo || gamma>w.hi) continue;
+
+			if (ret>=gamma) w.lo=gamma, w.move_i=t.root_move;
+			else w.hi=gamma-1;
+
+			for (int i=0; i<=nt; i++) {
+				if (w.probing[i]!=NO_PROBE && (w.probing[i]<=w.lo || w.probing[i]>w.hi)) cancel[i]=true;
+			}
+		}
+	}
+
+	// the tt's best move for the position with hash h, -1 if none
+	int tt_move(uint64_t h) {
+		TTData d{};
+		return cache.probe(h, d) ? d.move_i : -1;
+	}
+
+	int hash_move(Position const& pos) {
+		return tt_move(hash(pos));
+	}
+
+	// drops everything not touched in the last max_age searches, between moves
+	void trim(int max_age) {
+		cache.trim(std::min(max_age, (1<<TT::GEN_BITS)-2));
+		pos_c.trim(max_age);
+	}
+
+	virtual ~Searcher() = default;
+
+	// limits come from tm, set with set_movetime / set_clock beforehand
+	virtual SearchOut search(Position const& current) {
+		Window win;
+		win.probing.assign(nt+1, NO_PROBE);
+
+		return run(current, [&](Worker& t, SearchState const& init, SearchOut& out) {
+			if (driver==Driver::Bisect) bisect(t, init, win, out);
+			else iterate(t, init, out);
+		});
+	}
+
+	// sets up the root and runs body(worker, init, out) on every thread,
+	// the caller's becomes the main thread (lua_i 0). out.move_i is the body's to set
+	template<class F>
+	SearchOut run(Position const& current, F&& body) {
+		tm.begin();
 
 		SearchOut out;
-		out.pos_type = interfaces[0].get_pos_type(current);
+		out.pos_type = pos_type(interfaces[0], current);
 		if (out.pos_type!=PosType::Other) return out; // leaf
 
 		interfaces[0].valid_moves(out.possible, current);
 
 		SearchState init(
 			current, hash(current),
-			score(current), 0
+			score(current), 0, eval(current)
 		);
 
-		for (int depth=1; !tle && depth<=max_depth; depth++) {
-			init.depth=depth;
-			std::cerr<<"depth "<<depth<<", cache size "<<cache.size()<<std::endl;
-
-			auto now = std::chrono::steady_clock::now();
-
-			int lo=LOSING, hi=WINNING;
-			while (!tle && hi-lo > EVAL_ROUGHNESS) {
-				int mid = (hi+lo+1)/2;
-
-				auto ret = bound(0, init, mid);
+		std::mutex err_mut;
+		std::exception_ptr err;
+		// never clear stop here, another thread may have set it since the last search
+		if (cancelled) stop=true;
+		for (int i=0; i<=nt; i++) cancel[i]=false;
+		for (Worker& t: workers) t.new_search();
+		cache.new_search();
+		pos_c.new_epoch();
+
+		// launch_all runs the last index on this thread, which becomes the main thread
+		pool.launch_all([&](int ti) {
+			int lua_i = ti==nt ? 0 : ti+1;
+
+			try {
+				body(workers[lua_i], init, out);
+			} catch (SearchAbort&) {
+			} catch (...) {
+				std::scoped_lock lock(err_mut);
+				if (!err) err=std::current_exception();
+			}
 
-				if (ret >= mid) lo=mid;
-				else hi=mid-1;
+			if (!lua_i || err) stop=true;
+		}, nt+1);
 
-				tle|=std::chrono::duration_cast<std::chrono::milliseconds>(now-start).count() > TIME_LIMIT;
-			}
+		stop=false;
+		if (err) std::rethrow_exception(err);
+		print_pruning();
 
-			auto it = killer_move.find(hash(current));
-			if (it!=killer_move.end()) out.move_i=it->second;
+		// out of time before depth 1 finished (or a tt collision), anything legal beats no move
+		if ((out.move_i<0 || out.move_i>=out.possible.size()) && !out.possible.empty()) {
+			out.move_i = tt_move(init.hash);
+			if (out.move_i<0 || out.move_i>=out.possible.size()) out.move_i=0;
 		}
 
 		return out;
@@ -0,0 +1,85 @@
+#include "lua_interface.hpp"
+#include "search.hpp"
+#include "search2.hpp"
+
+#ifndef BUILD_DEBUG
+#include <mimalloc-new-delete.h>
+#endif
+
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+// time to depth, root probes and nodes from the initial position for each root driver / engine:
+//   searchbench <lua> <n> <m> <npty> [depth] [threads]
+int main(int argc, char** argv) {
+	if (argc<5) {
+		cerr<<"usage: searchbench <lua> <n> <m> <npty> [depth] [threads]"<<endl;
+		return 1;
+	}
+
+	std::string lua = argv[1];
+	int n = atoi(argv[2]), m = atoi(argv[3]), npty = atoi(argv[4]);
+	int depth = argc>5 ? atoi(argv[5]) : 6;
+	int threads = argc>6 ? atoi(argv[6]) : 4;
+
+	auto interface = LuaInterface(lua);
+	auto init = interface.initial_position();
+
+	struct Run {
+		char const* name;
+		Driver driver;
+		int nt;
+		bool ybw=false;
+	};
+
+	// lazy smp without helpers is the plain serial bisection
+	vec<Run> runs = {
+		{"lazy smp", Driver::LazySMP, 0},
+		{"mtd(f)", Driver::MTDF, 0},
+		{"pvs", Driver::PVS, 0},
+		{"lazy smp", Driver::LazySMP, threads},
+		{"parallel bisect", Driver::Bisect, threads},
+		{"ybw", Driver::LazySMP, threads, true}
+	};
+
+	vec<Searcher::SearchOut> res;
+	for (Run const& r: runs) {
+		// fresh tables for each run, so no driver starts from another's cache
+		unique_ptr<Searcher> searcher;
+		if (r.ybw) searcher = make_unique<YBWSearcher>(npty, n, m, depth, r.nt, lua);
+		else searcher = make_unique<Searcher>(npty, n, m, depth, r.nt, lua);
+
+		searcher->driver = r.driver;
+		// no time limit, run to depth
+		searcher->tm.infinite = true;
+
+		auto out = searcher->search(init);
+		res.push_back(std::move(out));
+	}
+
+	// one table each for time to depth, root probes per iteration and nodes to depth
+	auto table = [&](char const* title, auto&& cell) {
+		cout<<title;
+		for (Run const& r: runs) cout<<'\t'<<r.name<<" ("<<r.nt+1<<"t)";
+		cout<<endl;
+
+		for (int d=0; d<depth; d++) {
+			cout<<d+1;
+			for (auto const& out: res) {
+				if (d<out.depth_ms.size()) cout<<'\t'<<cell(out, d);
+				else cout<<"\t-";
+			}
+			cout<<endl;
+		}
+
+		cout<<endl;
+	};
+
+	table("ms", [](Searcher::SearchOut const& out, int d) { return out.depth_ms[d]; });
+	table("probes", [](Searcher::SearchOut const& out, int d) { return out.depth_probes[d]; });
+	table("nodes", [](Searcher::SearchOut const& out, int d) { return out.depth_nodes[d]; });
+
+	return 0;
+}
@@ -57,17 +57,20 @@ struct ServerIO {
 		return pos;
 	}
 
-	void send_move(const Move& move,int n,int m) {
+	// moves go over the wire with the whole board after them, pos is the one before
+	void send_move(const Position& pos, const Move& move,int n,int m) {
 		send_coord(move.from);
 		send_coord(move.to);
-		send_board(move.board,n,m);
+		send_board(after_move(pos, move).board,n,m);
 	}
 
-	Move receive_move() {
+	Move receive_move(const Position& pos, int n, int m) {
 		Move move;
 		move.from = receive_coord();
 		move.to = receive_coord();
-		receive_board(move.board);
+		Position after = pos;
+		receive_board(after.board);
+		move.delta.set_diff(pos.board, after.board, n*m);
 		return move;
 	}
 };
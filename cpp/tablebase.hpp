@@ -0,0 +1,440 @@
+#pragma once
+
+/*
+ * Endgame Tablebases
+ *
+ * Exact win / draw / loss and distance to mate (plies to the end of the game) for
+ * every placement of a fixed piece set on the board, either player to move.
+ *
+ * Index: pieces of the same type are interchangeable, so each group of c identical
+ * pieces is ranked as a c-combination of squares (colex order), and the groups and
+ * the player to move are mixed radix on top. Every position has exactly one index;
+ * indices whose groups overlap on a square are marked invalid.
+ *
+ * Generation runs valid_moves forward once per position, threads splitting the
+ * index range with a lua state each, and keeps each in-table move as a reverse edge
+ * (the predecessor function). Moves leaving the table (captures, promotions) are
+ * valued from lua's Type or an already generated smaller table; the generator does
+ * every sub-set of the pieces first. Retrograde analysis then works outward from
+ * the finished games by distance: a predecessor of a loss is a win one ply further,
+ * a position whose every move reaches a win is a loss at the longest of them. What
+ * is never settled is a draw (a move into an unknown table counts as one).
+ *
+ * Files hold a header, 2 bit packed wdl values and a byte of dtm (capped at 255)
+ * per index, and are mmapped for probing.
+ *
+ * Usage:
+ *   TBGen gen(n, m, nt, lua_path);
+ *   gen.generate_all({6, 12, 4}, dir);
+ *   TablebaseSet tbs; tbs.load_dir(dir, n*m);
+ *   if (tbs.probe(pos, pty, dtm)) ...
+ */
+
+#include "lua_interface.hpp"
+#include "pool.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// the rank of a piece set's positions, see the top of the file
+struct TBIndex {
+	int nm;
+	// sorted piece types, and (type, count) of each run of equal ones
+	vec<int> pieces;
+	vec<std::pair<int,int>> groups;
+	vec<uint64_t> group_size;
+	// group of each piece type, -1 if not in the set
+	std::array<int, 256> group_of;
+	// binom[s][c] = s choose c
+	vec<vec<uint64_t>> binom;
+	uint64_t size;
+
+	TBIndex(int nm_, vec<int> pieces_): nm(nm_), pieces(std::move(pieces_)) {
+		std::sort(pieces.begin(), pieces.end());
+		group_of.fill(-1);
+		for (int p: pieces) {
+			if (groups.empty() || groups.back().first!=p) {
+				group_of[p] = groups.size();
+				groups.push_back({p, 0});
+			}
+
+			groups.back().second++;
+		}
+
+		binom.assign(nm+1, vec<uint64_t>(pieces.size()+1, 0));
+		for (int s=0; s<=nm; s++) {
+			binom[s][0]=1;
+			for (int c=1; c<=pieces.size() && c<=s; c++) binom[s][c] = binom[s-1][c-1] + (c<s ? binom[s-1][c] : 0);
+		}
+
+		size=2;
+		for (auto [p, c]: groups) {
+			group_size.push_back(binom[nm][c]);
+			size*=binom[nm][c];
+		}
+	}
+
+	// -1 if pos doesn't have exactly these pieces
+	int64_t index(Position const& pos) const {
+		// squares of each group, ascending, ranked as we go
+		uint64_t rank[16] {};
+		int cnt[16] {};
+
+		for (int x=0; x<nm; x++) {
+			int p = pos.board[x];
+			if (!p) continue;
+
+			int g = group_of[p];
+			if (g<0 || cnt[g]==groups[g].second) return -1;
+			rank[g] += binom[x][++cnt[g]];
+		}
+
+		uint64_t o=0;
+		for (int g=0; g<groups.size(); g++) {
+			if (cnt[g]!=groups[g].second) return -1;
+			o = o*group_size[g] + rank[g];
+		}
+
+		return o*2 + pos.next_player;
+	}
+
+	// false if two groups land on the same square
+	bool position(uint64_t idx, Position& pos) const {
+		std::fill(pos.board, pos.board+MAX_BOARD_SIZE, 0);
+		pos.next_player = idx%2;
+		idx/=2;
+
+		for (int g=groups.size()-1; g>=0; g--) {
+			uint64_t r = idx%group_size[g];
+			idx/=group_size[g];
+
+			for (int c=groups[g].second; c>=1; c--) {
+				int s=c-1;
+				while (s+1<nm && binom[s+1][c]<=r) s++;
+				r-=binom[s][c];
+
+				if (pos.board[s]) return false;
+				pos.board[s] = groups[g].first;
+			}
+		}
+
+		return true;
+	}
+
+	std::string name() const {
+		std::string o;
+		for (int p: pieces) o += (o.empty() ? "" : "_") + std::to_string(p);
+		return o + ".tb";
+	}
+};
+
+// one mmapped table file
+struct Tablebase {
+	enum: unsigned char { DRAW, WIN, LOSS, INVALID };
+
+	struct Header {
+		char magic[4];
+		int32_t n, m, k;
+		int32_t pieces[16];
+		uint64_t size;
+	};
+
+	std::unique_ptr<TBIndex> ix;
+	unsigned char const* data=nullptr;
+	size_t len=0;
+	unsigned char const *wdl, *dtm;
+
+	Tablebase() = default;
+	Tablebase(Tablebase const&) = delete;
+	~Tablebase() {
+		if (data) munmap(const_cast<unsigned char*>(data), len);
+	}
+
+	static size_t wdl_bytes(uint64_t size) {
+		return (size+3)/4;
+	}
+
+	bool open(std::string const& path, int nm) {
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd<0) return false;
+
+		struct stat st;
+		fstat(fd, &st);
+		len = st.st_size;
+		void* p = len>=sizeof(Header) ? mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+		::close(fd);
+		if (p==MAP_FAILED) return false;
+		data = static_cast<unsigned char const*>(p);
+
+		Header const& h = *reinterpret_cast<Header const*>(data);
+		if (std::string(h.magic, 4)!="BMTB" || h.n*h.m!=nm || h.k>16) return false;
+
+		ix = std::make_unique<TBIndex>(nm, vec<int>(h.pieces, h.pieces+h.k));
+		wdl = data+sizeof(Header);
+		dtm = wdl+wdl_bytes(h.size);
+		return ix->size==h.size && len>=sizeof(Header)+wdl_bytes(h.size)+h.size;
+	}
+
+	// for the player to move, false if pos isn't in the table
+	bool probe(Position const& pos, PosType& pty, int& d) const {
+		int64_t i = ix->index(pos);
+		if (i<0) return false;
+
+		int v = (wdl[i/4]>>(2*(i%4)))&3;
+		if (v==INVALID) return false;
+
+		pty = v==WIN ? PosType::Win : v==LOSS ? PosType::Loss : PosType::Draw;
+		d = dtm[i];
+		return true;
+	}
+
+	static void write(std::string const& path, TBIndex const& ix, int n, int m,
+		vec<unsigned char> const& wdl, vec<unsigned char> const& dtm) {
+		Header h {.magic={'B','M','T','B'}, .n=n, .m=m, .k=int32_t(ix.pieces.size()), .pieces={}, .size=ix.size};
+		std::copy(ix.pieces.begin(), ix.pieces.end(), h.pieces);
+
+		std::ofstream out(path, std::ios::binary);
+		out.write(reinterpret_cast<char const*>(&h), sizeof(h));
+		out.write(reinterpret_cast<char const*>(wdl.data()), wdl.size());
+		out.write(reinterpret_cast<char const*>(dtm.data()), dtm.size());
+	}
+};
+
+// every table loaded, found by the position's piece set
+struct TablebaseSet {
+	// tables are keyed by their sorted piece types, a byte each
+	static constexpr int MAX_PIECES = 8;
+
+	::map<uint64_t, std::unique_ptr<Tablebase>> tables;
+	int max_pieces=0;
+
+	static uint64_t key(unsigned char* pieces, int k) {
+		// insertion sort, k is at most MAX_PIECES
+		for (int i=1; i<k; i++) {
+			for (int j=i; j>0 && pieces[j-1]>pieces[j]; j--) std::swap(pieces[j-1], pieces[j]);
+		}
+
+		uint64_t o=0;
+		for (int i=0; i<k; i++) o = o<<8 | pieces[i];
+		return o;
+	}
+
+	void add(std::unique_ptr<Tablebase> tb) {
+		vec<int> const& pieces = tb->ix->pieces;
+		if (pieces.size()>MAX_PIECES) return;
+
+		unsigned char p[MAX_PIECES];
+		std::copy(pieces.begin(), pieces.end(), p);
+		max_pieces = std::max<int>(max_pieces, pieces.size());
+		tables[key(p, pieces.size())] = std::move(tb);
+	}
+
+	// loads every .tb file in dir, returns how many
+	int load_dir(std::string const& dir, int nm) {
+		int o=0;
+		std::error_code ec;
+		for (auto const& e: std::filesystem::directory_iterator(dir, ec)) {
+			if (e.path().extension()!=".tb") continue;
+
+			auto tb = std::make_unique<Tablebase>();
+			if (tb->open(e.path().string(), nm)) add(std::move(tb)), o++;
+		}
+
+		return o;
+	}
+
+	// called at every node once tables are loaded, so nothing here allocates
+	bool probe(Position const& pos, int nm, PosType& pty, int& d) const {
+		if (tables.empty()) return false;
+
+		static constexpr unsigned char empty[MAX_BOARD_SIZE] {};
+		uint64_t occupied = board_diff(pos.board, empty, nm);
+		int k = std::popcount(occupied);
+		if (k>max_pieces) return false;
+
+		unsigned char pieces[MAX_PIECES];
+		for (int i=0; occupied; occupied&=occupied-1) pieces[i++] = pos.board[std::countr_zero(occupied)];
+
+		auto it = tables.find(key(pieces, k));
+		return it!=tables.end() && it->second->probe(pos, pty, d);
+	}
+};
+
+struct TBGen {
+	int n, m, nt;
+	vec<LuaInterface> interfaces;
+	Pool pool;
+	// tables already done, for moves that leave the one being generated
+	TablebaseSet known;
+
+	TBGen(int n_, int m_, int nt_, std::string const& lua_path): n(n_), m(m_), nt(nt_), pool(nt_) {
+		for (int i=0; i<=nt; i++) interfaces.emplace_back(lua_path);
+	}
+
+	// the set and every sub-set of it, smallest first, skipping files already in dir
+	void generate_all(vec<int> pieces, std::string const& dir) {
+		std::sort(pieces.begin(), pieces.end());
+		std::set<vec<int>> subsets {pieces};
+		for (int k=pieces.size(); k>1; k--) {
+			for (auto const& s: subsets) {
+				if (s.size()!=k) continue;
+				for (int i=0; i<k; i++) {
+					vec<int> sub = s;
+					sub.erase(sub.begin()+i);
+					subsets.insert(sub);
+				}
+			}
+		}
+
+		known.load_dir(dir, n*m);
+		for (int k=1; k<=pieces.size(); k++) {
+			for (auto const& s: subsets) {
+				if (s.size()!=k) continue;
+
+				std::string path = dir + "/" + TBIndex(n*m, s).name();
+				if (!std::filesystem::exists(path)) generate(s, path);
+
+				auto tb = std::make_unique<Tablebase>();
+				if (tb->open(path, n*m)) known.add(std::move(tb));
+			}
+		}
+	}
+
+	void generate(vec<int> const& pieces, std::string const& path) {
+		TBIndex ix(n*m, pieces);
+		uint64_t S = ix.size;
+		if (S>=(uint64_t(1)<<32)) throw std::runtime_error("tablebase too large for 32 bit indices");
+
+		enum: unsigned char { UNSET=255 };
+		vec<unsigned char> val(S, UNSET);
+		// moves not yet known to reach a win, and the longest such win so far
+		vec<uint16_t> left(S, 0);
+		vec<uint16_t> maxd(S, 0);
+		// settled at a distance: finished games, and moves into other tables
+		vec<vec<uint32_t>> win_at(2), loss_at(2);
+		auto push = [](vec<vec<uint32_t>>& at, int d, uint32_t i) {
+			if (at.size()<=d) at.resize(d+1);
+			at[d].push_back(i);
+		};
+
+		// forward pass: each thread takes every nt+1-th index
+		struct Out {
+			vec<std::pair<uint32_t, uint32_t>> edges; // (position, in-table child)
+			vec<std::pair<uint32_t, int>> wins, losses; // (position, distance)
+		};
+		vec<Out> outs(nt+1);
+
+		pool.launch_all([&](int ti) {
+			auto& lua = interfaces[ti];
+			Out& o = outs[ti];
+			vec<Move> moves;
+
+			for (uint64_t i=ti; i<S; i+=nt+1) {
+				Position pos;
+				if (!ix.position(i, pos)) {
+					val[i] = Tablebase::INVALID;
+					continue;
+				}
+
+				PosType pty = lua.get_pos_type(pos);
+				if (pty!=PosType::Other) {
+					if (pty==PosType::Draw) val[i] = Tablebase::DRAW;
+					else (pty==PosType::Win ? o.wins : o.losses).push_back({i, 0});
+					continue;
+				}
+
+				moves.clear();
+				lua.valid_moves(moves, pos);
+				if (moves.empty()) {
+					val[i] = Tablebase::DRAW;
+					continue;
+				}
+
+				int l = moves.size();
+				int md = 0;
+				for (Move const& mv: moves) {
+					Position c = after_move(pos, mv);
+
+					int64_t ci = ix.index(c);
+					if (ci>=0) {
+						o.edges.push_back({i, ci});
+						continue;
+					}
+
+					PosType cp = lua.get_pos_type(c);
+					int cd = 0;
+					if (cp==PosType::Other && !known.probe(c, n*m, cp, cd)) continue;
+
+					// cp is for the opponent
+					if (cp==PosType::Loss) o.wins.push_back({i, cd+1});
+					else if (cp==PosType::Win) l--, md = std::max(md, cd+1);
+				}
+
+				left[i]=l, maxd[i]=md;
+				if (!l) o.losses.push_back({i, md});
+			}
+		}, nt+1);
+
+		// predecessors of each position, as offsets into one array. positions fit in 32
+		// bits, the edges between them don't have to
+		vec<uint64_t> pred_off(S+1, 0);
+		for (Out const& o: outs) for (auto [p, c]: o.edges) pred_off[c+1]++;
+		for (uint64_t i=0; i<S; i++) pred_off[i+1] += pred_off[i];
+
+		vec<uint32_t> preds(pred_off[S]);
+		{
+			vec<uint64_t> fill(pred_off.begin(), pred_off.end()-1);
+			for (Out& o: outs) {
+				for (auto [p, c]: o.edges) preds[fill[c]++] = p;
+				for (auto [p, d]: o.wins) push(win_at, d, p);
+				for (auto [p, d]: o.losses) push(loss_at, d, p);
+				o = Out {};
+			}
+		}
+
+		vec<unsigned char> dtm(S, 0);
+		for (int d=0; d<std::max(win_at.size(), loss_at.size()); d++) {
+			if (d<loss_at.size()) for (uint32_t i: loss_at[d]) {
+				if (val[i]!=UNSET) continue;
+				val[i] = Tablebase::LOSS, dtm[i] = std::min(d, 255);
+				for (uint64_t k=pred_off[i]; k<pred_off[i+1]; k++) {
+					if (val[preds[k]]==UNSET) push(win_at, d+1, preds[k]);
+				}
+			}
+
+			if (d<win_at.size()) for (uint32_t i: win_at[d]) {
+				if (val[i]!=UNSET) continue;
+				val[i] = Tablebase::WIN, dtm[i] = std::min(d, 255);
+				for (uint64_t k=pred_off[i]; k<pred_off[i+1]; k++) {
+					uint32_t q = preds[k];
+					if (val[q]!=UNSET) continue;
+
+					maxd[q] = std::max<int>(maxd[q], d+1);
+					if (--left[q]==0) push(loss_at, maxd[q], q);
+				}
+			}
+		}
+
+		vec<unsigned char> wdl(Tablebase::wdl_bytes(S), 0);
+		uint64_t counts[4] {};
+		for (uint64_t i=0; i<S; i++) {
+			int v = val[i]==UNSET ? int(Tablebase::DRAW) : val[i];
+			counts[v]++;
+			wdl[i/4] |= v<<(2*(i%4));
+		}
+
+		Tablebase::write(path, ix, n, m, wdl, dtm);
+		std::cerr<<path<<": "<<counts[Tablebase::WIN]<<" wins, "<<counts[Tablebase::LOSS]<<" losses, "
+			<<counts[Tablebase::DRAW]<<" draws, "<<counts[Tablebase::INVALID]<<" invalid"<<std::endl;
+	}
+};
@@ -0,0 +1,75 @@
+#include "tablebase.hpp"
+
+#include <iostream>
+
+using namespace std;
+
+// every board holding exactly the piece set gets a distinct in-range index that
+// position() turns back into it, and every index position() accepts is one of them
+static bool round_trip(int nm, vec<int> const& pieces, int max_pty) {
+	TBIndex ix(nm, pieces);
+
+	vec<int> want(max_pty+1, 0);
+	for (int p: pieces) want[p]++;
+
+	vec<char> seen(ix.size, 0);
+	uint64_t boards=0;
+
+	// all (max_pty+1)^nm boards, kept if the counts match
+	Position pos {};
+	vec<int> digit(nm, 0);
+	while (true) {
+		vec<int> cnt(max_pty+1, 0);
+		for (int x=0; x<nm; x++) pos.board[x]=digit[x], cnt[digit[x]]++;
+
+		bool match=true;
+		for (int p=1; p<=max_pty; p++) match &= cnt[p]==want[p];
+
+		for (int pl=0; match && pl<2; pl++) {
+			pos.next_player=pl;
+			int64_t i = ix.index(pos);
+			if (i<0 || i>=ix.size || seen[i]) {
+				cerr<<nm<<" squares: bad or repeated index "<<i<<endl;
+				return false;
+			}
+
+			seen[i]=1, boards++;
+			Position back;
+			if (!ix.position(i, back) || back.next_player!=pl || !equal(back.board, back.board+nm, pos.board)) {
+				cerr<<nm<<" squares: index "<<i<<" doesn't map back"<<endl;
+				return false;
+			}
+		}
+
+		if (!match) {
+			pos.next_player=0;
+			if (ix.index(pos)!=-1) {
+				cerr<<nm<<" squares: index for the wrong piece set"<<endl;
+				return false;
+			}
+		}
+
+		int x=0;
+		while (x<nm && digit[x]==max_pty) digit[x++]=0;
+		if (x==nm) break;
+		digit[x]++;
+	}
+
+	for (uint64_t i=0; i<ix.size; i++) {
+		Position p;
+		if (ix.position(i, p) && !seen[i]) {
+			cerr<<nm<<" squares: index "<<i<<" valid but never reached"<<endl;
+			return false;
+		}
+	}
+
+	cout<<ix.name()<<" on "<<nm<<" squares: "<<boards<<" positions of "<<ix.size<<" indices"<<endl;
+	return true;
+}
+
+int main() {
+	bool ok = round_trip(10, {1, 1, 2, 2}, 2)  // the 1x10 spec game
+		&& round_trip(9, {3, 1, 2, 2}, 3)       // 3x3
+		&& round_trip(9, {1, 1, 1}, 2);
+	return ok ? 0 : 1;
+}
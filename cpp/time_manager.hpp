@@ -0,0 +1,100 @@
+#pragma once
+
+/*
+ * Time Manager
+ *
+ * Turns either a fixed per-move budget or a remaining clock + increment into two
+ * limits for one search:
+ *   soft: don't start another iteration past this, it likely won't finish
+ *   hard: abort the search in progress
+ *
+ * Limits are atomics so another thread (e.g. the protocol loop) can change them
+ * while a search is running. An infinite search (pondering) never expires until
+ * ponderhit() turns the normal limits back on, counted from the ponderhit: the
+ * time pondered was the opponent's, not ours.
+ *
+ * Usage:
+ *   TimeManager tm;
+ *   tm.set_clock(remaining_ms, inc_ms);  // or tm.set_movetime(ms)
+ *   tm.begin();
+ *   if (tm.hard_expired()) abort...
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+struct TimeManager {
+	using clock = std::chrono::steady_clock;
+
+	// kept back from the clock for the protocol round trip
+	static constexpr int64_t OVERHEAD_MS = 50;
+
+	// reset by ponderhit() while the search reads it
+	std::atomic<clock::time_point> start;
+	std::atomic<int64_t> soft_ms, hard_ms;
+	std::atomic<bool> infinite=false;
+
+	// per move budget, or remaining clock + increment
+	std::atomic<int64_t> movetime=-1, remaining=-1, inc=0;
+
+	TimeManager(int64_t movetime_ms=10000) {
+		set_movetime(movetime_ms);
+	}
+
+	void set_movetime(int64_t ms) {
+		movetime=ms, remaining=-1, inc=0;
+	}
+
+	void set_clock(int64_t remaining_ms, int64_t inc_ms) {
+		movetime=-1, remaining=remaining_ms, inc=inc_ms;
+	}
+
+	// starts the clock for one search
+	void begin() {
+		start.store(clock::now(), std::memory_order_relaxed);
+		set_limits();
+	}
+
+	void set_limits() {
+		if (movetime>=0) {
+			hard_ms = movetime.load();
+			soft_ms = movetime/2;
+		} else {
+			int64_t left = std::max<int64_t>(remaining-OVERHEAD_MS, 1);
+			int64_t budget = std::min(left/30 + inc*3/4, left);
+
+			hard_ms = std::min({budget*3, left/3 + inc, left});
+			soft_ms = budget/2;
+		}
+	}
+
+	int64_t elapsed() const {
+		auto since = clock::now()-start.load(std::memory_order_relaxed);
+		return std::chrono::duration_cast<std::chrono::milliseconds>(since).count();
+	}
+
+	// the clock may have been updated while pondering
+	void ponderhit() {
+		start.store(clock::now(), std::memory_order_relaxed);
+		set_limits();
+		infinite=false;
+	}
+
+	bool soft_expired() const {
+		return !infinite.load(std::memory_order_relaxed)
+			&& elapsed() >= soft_ms.load(std::memory_order_relaxed);
+	}
+
+	// for anytime searches (mcts) that can stop at any point: the whole budget, twice soft
+	bool budget_expired() const {
+		return !infinite.load(std::memory_order_relaxed)
+			&& elapsed() >= 2*soft_ms.load(std::memory_order_relaxed);
+	}
+
+	bool hard_expired() const {
+		return !infinite.load(std::memory_order_relaxed)
+			&& elapsed() >= hard_ms.load(std::memory_order_relaxed);
+	}
+};
@@ -88,7 +88,7 @@ private:
         GameRecord record;
         
         while (true) {
-            auto pos_type = lua.get_pos_type(pos);
+            auto pos_type = searcher.pos_type(lua, pos);
             auto pos_type_str = pos_type == PosType::Win ? "Win" : 
                 pos_type == PosType::Loss ? "Loss" : 
                 pos_type == PosType::Draw ? "Draw" : "Other";
@@ -132,10 +132,10 @@ private:
             record.positions.push_back(pos);
             record.scores.push_back(searcher.score(pos));
 
-            printBoardStateHumanReadable(move.board);
-            
-            memcpy(pos.board, move.board, sizeof(pos.board));
+            move.delta.apply(pos.board);
             pos.next_player ^= 1;
+
+            printBoardStateHumanReadable(pos.board);
         }
 
         // Store game record
@@ -0,0 +1,219 @@
+#pragma once
+
+/*
+ * Transposition Table
+ *
+ * Fixed size, preallocated table of score bounds, sized in MB.
+ * Buckets are one cache line of 4 entries: the first 3 are depth-preferred,
+ * the last one is always replaced. Entries carry the generation (search number)
+ * that last wrote them, older generations lose their depth preference.
+ *
+ * Reads and writes are lockless: an entry is two 64 bit words, the data and
+ * key^data. A torn write from a concurrent store makes the xor fail to match
+ * the probed hash, so it reads as a miss instead of another position's bounds.
+ *
+ * Usage:
+ *   TT tt(64);  // 64MB
+ *   tt.new_search();
+ *   TTData d{}; if (tt.probe(hash, d) && d.depth>=depth) ...
+ *   tt.store(hash, depth, lo, hi, move_i);
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+struct TTData {
+	// lo <= optimal score <= hi
+	int lo, hi;
+	int move_i; // -1 if unknown
+	int depth;
+	int gen;
+};
+
+struct TT {
+	// data layout, low to high: lo 20 | hi 20 | move_i+1 12 | depth 8 | gen 4
+	static constexpr int SCORE_BITS=20, MOVE_BITS=12, DEPTH_BITS=8, GEN_BITS=4;
+	static constexpr int SCORE_OFF = 1<<(SCORE_BITS-1);
+	// scores are clamped to +-MAX_SCORE to fit their field
+	static constexpr int MAX_SCORE = SCORE_OFF-1;
+	static constexpr int BUCKET = 4;
+
+	struct Entry {
+		std::atomic<uint64_t> key, data;
+	};
+
+	struct alignas(64) Bucket {
+		Entry e[BUCKET];
+	};
+
+	std::unique_ptr<Bucket[]> table;
+	uint64_t mask;
+	int gen=0;
+
+	TT(int mb) {
+		uint64_t n=1;
+		while (2*n*sizeof(Bucket) <= (uint64_t(mb)<<20)) n*=2;
+
+		table.reset(new Bucket[n]());
+		mask=n-1;
+	}
+
+	static uint64_t pack(TTData const& d) {
+		auto field = [](uint64_t x, int bits) { return x & ((uint64_t(1)<<bits)-1); };
+
+		uint64_t o = field(d.lo+SCORE_OFF, SCORE_BITS);
+		o |= field(d.hi+SCORE_OFF, SCORE_BITS) << SCORE_BITS;
+		o |= field(d.move_i+1, MOVE_BITS) << (2*SCORE_BITS);
+		o |= field(d.depth, DEPTH_BITS) << (2*SCORE_BITS+MOVE_BITS);
+		o |= field(d.gen, GEN_BITS) << (2*SCORE_BITS+MOVE_BITS+DEPTH_BITS);
+		return o;
+	}
+
+	static TTData unpack(uint64_t x) {
+		auto field = [x](int off, int bits) { return int((x>>off) & ((uint64_t(1)<<bits)-1)); };
+
+		return TTData {
+			.lo = field(0, SCORE_BITS)-SCORE_OFF,
+			.hi = field(SCORE_BITS, SCORE_BITS)-SCORE_OFF,
+			.move_i = field(2*SCORE_BITS, MOVE_BITS)-1,
+			.depth = field(2*SCORE_BITS+MOVE_BITS, DEPTH_BITS),
+			.gen = field(2*SCORE_BITS+MOVE_BITS+DEPTH_BITS, GEN_BITS)
+		};
+	}
+
+	// data is never 0 for a stored entry since lo+SCORE_OFF>0
+	bool read(Entry const& e, uint64_t hash, TTData& out) const {
+		uint64_t data = e.data.load(std::memory_order_relaxed);
+		uint64_t key = e.key.load(std::memory_order_relaxed);
+		if (data==0 || (key^data)!=hash) return false;
+
+		out = unpack(data);
+		return true;
+	}
+
+	void write(Entry& e, uint64_t hash, TTData const& d) {
+		uint64_t data = pack(d);
+		e.key.store(hash^data, std::memory_order_relaxed);
+		e.data.store(data, std::memory_order_relaxed);
+	}
+
+	static uint64_t with_gen(uint64_t data, int g) {
+		constexpr int off = 2*SCORE_BITS+MOVE_BITS+DEPTH_BITS;
+		constexpr uint64_t gen_mask = ((uint64_t(1)<<GEN_BITS)-1) << off;
+		return (data&~gen_mask) | (uint64_t(g)<<off);
+	}
+
+	// a hit from an older generation is refreshed, it's still useful. only the gen
+	// bits change, and only if no store got to the entry since it was read
+	bool probe(uint64_t hash, TTData& out) {
+		Bucket& b = table[hash&mask];
+		for (Entry& e: b.e) {
+			uint64_t data = e.data.load(std::memory_order_relaxed);
+			uint64_t key = e.key.load(std::memory_order_relaxed);
+			if (data==0 || (key^data)!=hash) continue;
+
+			out = unpack(data);
+			if (out.gen!=gen) {
+				uint64_t fresh = with_gen(data, gen);
+				if (e.data.compare_exchange_strong(data, fresh, std::memory_order_relaxed)) {
+					e.key.store(hash^fresh, std::memory_order_relaxed);
+				}
+				out.gen=gen;
+			}
+			return true;
+		}
+
+		return false;
+	}
+
+	int age(int g) const {
+		return (gen-g) & ((1<<GEN_BITS)-1);
+	}
+
+	// how much an entry is worth keeping, old generations count as shallow
+	int worth(TTData const& d) const {
+		return d.depth - 8*age(d.gen);
+	}
+
+	void new_search() {
+		gen = (gen+1) & ((1<<GEN_BITS)-1);
+	}
+
+	// narrows the stored bounds if the entry is at the same depth, replaces it if this
+	// one is deeper. a shallower result never overwrites the position's entry
+	void store(uint64_t hash, int depth, int lo, int hi, int move_i) {
+		depth = std::min(depth, (1<<DEPTH_BITS)-1);
+		lo = std::clamp(lo, -MAX_SCORE, MAX_SCORE), hi = std::clamp(hi, -MAX_SCORE, MAX_SCORE);
+
+		Bucket& b = table[hash&mask];
+		TTData cur = {lo, hi, move_i, depth, gen};
+
+		Entry* target=nullptr;
+		TTData old{};
+		for (Entry& e: b.e) {
+			if (read(e, hash, old)) {
+				target=&e;
+				break;
+			}
+		}
+
+		if (target && move_i==-1) cur.move_i=old.move_i;
+
+		if (target && old.depth==depth) {
+			cur.lo = std::max(old.lo, lo), cur.hi = std::min(old.hi, hi);
+			if (cur.lo>cur.hi) cur.lo=lo, cur.hi=hi; // unstable, trust the newer bound
+		} else if (target && worth(old)>depth) {
+			return; // keep the deeper result, whichever slot it is in
+		} else if (!target) {
+			// least worth depth-preferred slot, or always-replace if that is worth more
+			int victim_worth=1<<DEPTH_BITS;
+			for (int i=0; i<BUCKET-1; i++) {
+				uint64_t data = b.e[i].data.load(std::memory_order_relaxed);
+				int w = data==0 ? -(1<<DEPTH_BITS) : worth(unpack(data));
+				if (w<victim_worth) victim_worth=w, target=&b.e[i];
+			}
+
+			if (victim_worth>depth) target = &b.e[BUCKET-1];
+		}
+
+		write(*target, hash, cur);
+	}
+
+	// permille of sampled entries written this generation, like uci hashfull
+	int hashfull() const {
+		int used=0;
+		uint64_t n = std::min<uint64_t>(mask+1, 250);
+		for (uint64_t i=0; i<n; i++) {
+			for (Entry const& e: table[i].e) {
+				uint64_t data = e.data.load(std::memory_order_relaxed);
+				used += data!=0 && unpack(data).gen==gen;
+			}
+		}
+
+		return used*1000/(n*BUCKET);
+	}
+
+	// clears entries more than max_age generations old
+	void trim(int max_age) {
+		for (uint64_t i=0; i<=mask; i++) {
+			for (Entry& e: table[i].e) {
+				uint64_t data = e.data.load(std::memory_order_relaxed);
+				if (data!=0 && age(unpack(data).gen)>max_age) {
+					e.key.store(0, std::memory_order_relaxed);
+					e.data.store(0, std::memory_order_relaxed);
+				}
+			}
+		}
+	}
+
+	void clear() {
+		for (uint64_t i=0; i<=mask; i++) {
+			for (Entry& e: table[i].e) {
+				e.key.store(0, std::memory_order_relaxed);
+				e.data.store(0, std::memory_order_relaxed);
+			}
+		}
+	}
+};
@@ -5,6 +5,14 @@
 #endif
 
 #include <gtl/phmap.hpp>
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #ifndef BUILD_DEBUG
 #include <gtl/btree.hpp>
@@ -26,6 +34,37 @@ using map = std::unordered_map<K,V>;
 
 constexpr int MAX_BOARD_SIZE=64;
 
+// Bit i is set iff a[i]!=b[i], for the first nm squares.
+// Always reads MAX_BOARD_SIZE bytes, the squares past nm are masked out.
+inline uint64_t board_diff(unsigned char const* a, unsigned char const* b, int nm) {
+	static_assert(MAX_BOARD_SIZE==64);
+	uint64_t eq;
+
+#if defined(__AVX2__)
+	auto half = [&](int off) {
+		__m256i x = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(a+off));
+		__m256i y = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(b+off));
+		return uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y))));
+	};
+
+	eq = half(0) | half(32)<<32;
+#elif defined(__SSE2__)
+	auto quarter = [&](int off) {
+		__m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const*>(a+off));
+		__m128i y = _mm_loadu_si128(reinterpret_cast<__m128i const*>(b+off));
+		return uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(x, y))));
+	};
+
+	eq = quarter(0) | quarter(16)<<16 | quarter(32)<<32 | quarter(48)<<48;
+#else
+	eq=0;
+	for (int i=0; i<MAX_BOARD_SIZE; i++) eq |= uint64_t(a[i]==b[i])<<i;
+#endif
+
+	uint64_t in_board = nm>=64 ? ~uint64_t(0) : (uint64_t(1)<<nm)-1;
+	return ~eq & in_board;
+}
+
 struct Coord {
 	unsigned char i,j;
 
@@ -43,11 +82,160 @@ struct Position {
 	unsigned char board[MAX_BOARD_SIZE];
 };
 
+// A square a move changes, and the piece it leaves there.
+struct Change {
+	unsigned char sq, piece;
+};
+
+// The squares a move changes instead of the whole board after it, each square once
+// and only if its piece changes. Applied on a position in place, whoever reverts it
+// keeps what it overwrote.
+// Up to INLINE changes are kept in the delta itself. A move that changes more (a big
+// flip, a board reset) has them on the heap, with the pointer in the bytes of ch.
+struct MoveDelta {
+	// chess needs 4 (castling)
+	static constexpr int INLINE = 12;
+
+	unsigned char n=0;
+	Change ch[INLINE];
+
+	MoveDelta() = default;
+	MoveDelta(MoveDelta const& other) { copy(other); }
+	MoveDelta(MoveDelta&& other) noexcept { take(other); }
+	~MoveDelta() { release(); }
+
+	MoveDelta& operator=(MoveDelta const& other) {
+		if (this!=&other) release(), copy(other);
+		return *this;
+	}
+
+	MoveDelta& operator=(MoveDelta&& other) noexcept {
+		if (this!=&other) release(), take(other);
+		return *this;
+	}
+
+	bool big() const {
+		return n>INLINE;
+	}
+
+	Change const* begin() const {
+		return big() ? heap() : ch;
+	}
+
+	Change const* end() const {
+		return begin()+n;
+	}
+
+	// the delta from board a to board b
+	void set_diff(unsigned char const* a, unsigned char const* b, int nm) {
+		release();
+		uint64_t d = board_diff(a, b, nm);
+
+		Change* out = ch;
+		int k = std::popcount(d);
+		if (k>INLINE) {
+			out = new Change[k];
+			std::memcpy(ch, &out, sizeof(out));
+		}
+
+		n=k;
+		for (; d; d&=d-1) {
+			int x = std::countr_zero(d);
+			*out++ = {(unsigned char)x, b[x]};
+		}
+	}
+
+	void apply(unsigned char* board) const {
+		for (Change c: *this) board[c.sq] = c.piece;
+	}
+
+	// what's on sq after the move, board is from before it
+	int after(unsigned char const* board, int sq) const {
+		for (Change c: *this) if (c.sq==sq) return c.piece;
+		return board[sq];
+	}
+
+private:
+	static_assert(sizeof(ch) >= sizeof(Change*));
+
+	Change* heap() const {
+		Change* p;
+		std::memcpy(&p, ch, sizeof(p));
+		return p;
+	}
+
+	void copy(MoveDelta const& other) {
+		n = other.n;
+		if (!big()) {
+			std::copy(other.ch, other.ch+n, ch);
+			return;
+		}
+
+		Change* p = new Change[n];
+		std::copy(other.heap(), other.heap()+n, p);
+		std::memcpy(ch, &p, sizeof(p));
+	}
+
+	void take(MoveDelta& other) {
+		n = other.n;
+		std::memcpy(ch, other.ch, sizeof(ch));
+		other.n = 0;
+	}
+
+	void release() {
+		if (big()) delete[] heap();
+		n = 0;
+	}
+};
+
 // A move consists of:
 // A piece at a coordinate being moved to another coordinate.
-// A list of pieces being added or removed.
+// The squares it changes.
 // Handle the case when from == to.
 struct Move {
 	Coord from, to;
-	unsigned char board[MAX_BOARD_SIZE];
+	MoveDelta delta;
+	// MoveTag bits, and the piece taken if it's a capture
+	unsigned char tags=0, captured=0;
+};
+
+enum MoveTag: unsigned char {
+	TAG_CAPTURE=1, TAG_PROMOTION=2, TAG_CHECK=4,
+	// worth searching in quiescence
+	TAG_NOISY=TAG_CAPTURE|TAG_PROMOTION
 };
+
+// The position after move, with the other player to move.
+inline Position after_move(Position const& pos, Move const& move) {
+	Position o = pos;
+	move.delta.apply(o.board);
+	o.next_player = !pos.next_player;
+	return o;
+}
+
+// Capture / promotion tags from the delta, for scripts that don't give them.
+// A capture leaves fewer pieces on the board, the captured piece is the one on the
+// destination (or one that vanished elsewhere). A promotion changes the moving piece.
+// Checks can't be told without the rules.
+inline void derive_tags(Position const& pos, Move& move, int n, int m) {
+	int nm = n*m;
+	int from = move.from.i*m + move.from.j, to = move.to.i*m + move.to.j;
+	MoveDelta const& d = move.delta;
+	move.tags=0, move.captured=0;
+
+	int before=0, after=0;
+	for (Change c: d) before += pos.board[c.sq]!=0, after += c.piece!=0;
+
+	bool on_board = from<nm && to<nm;
+	if (after<before) {
+		move.tags|=TAG_CAPTURE;
+		if (on_board && pos.board[to]) move.captured=pos.board[to];
+		else for (Change c: d) {
+			if (c.sq!=from && pos.board[c.sq] && !c.piece) move.captured=pos.board[c.sq];
+		}
+	}
+
+	int moved = on_board ? d.after(pos.board, to) : 0;
+	if (on_board && pos.board[from] && moved && moved!=pos.board[from])
+		move.tags|=TAG_PROMOTION;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+/*
+ * Zobrist Hashing
+ *
+ * One random key per (piece, square) in a single flat array indexed piece*nm + square,
+ * plus a key for the second player to move.
+ *
+ * update() rehashes only the squares that differ between two boards, found with
+ * board_diff, or given by a move's delta, so a child's hash costs O(changed squares)
+ * instead of O(board).
+ */
+
+#include "util.hpp"
+#include <bit>
+#include <random>
+
+struct Zobrist {
+	int nm;
+	uint64_t player;
+	vec<uint64_t> table;
+
+	// same rng order as the nested per-piece tables this replaced, so hashes are unchanged
+	Zobrist(int max_pty, int nm_): nm(nm_) {
+		std::mt19937_64 rng(123);
+		player = rng();
+
+		table.resize((max_pty+1)*nm);
+		for (auto& x: table) x=rng();
+	}
+
+	uint64_t key(int pt, int sq) const {
+		return table[pt*nm + sq];
+	}
+
+	uint64_t hash(Position const& pos) const {
+		uint64_t o = pos.next_player ? player : 0;
+		for (int i=0; i<nm; i++) o^=key(pos.board[i], i);
+		return o;
+	}
+
+	// h is the hash of a board `from`, returns the hash with `to` on the board
+	// instead (same player to move)
+	uint64_t update(uint64_t h, unsigned char const* from, unsigned char const* to, uint64_t diff) const {
+		for (; diff; diff&=diff-1) {
+			int i = std::countr_zero(diff);
+			h ^= key(from[i], i)^key(to[i], i);
+		}
+
+		return h;
+	}
+
+	uint64_t update(uint64_t h, unsigned char const* from, unsigned char const* to) const {
+		return update(h, from, to, board_diff(from, to, nm));
+	}
+
+	// the hash after applying d to board
+	uint64_t update(uint64_t h, unsigned char const* board, MoveDelta const& d) const {
+		for (Change c: d) h ^= key(board[c.sq], c.sq)^key(c.piece, c.sq);
+
+		return h;
+	}
+};
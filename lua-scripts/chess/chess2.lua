@@ -6,6 +6,11 @@ piece_names = {
 
 BOARD_WIDTH = 8
 BOARD_HEIGHT = 8
+-- moves carry capture / promotion, see specification.lua
+MOVE_TAGS = true
+-- no zugzwang worth worrying about outside endgames, and captures decide the score
+NULL_MOVE = true
+PROBCUT = true
 
 -- Castling rights for each player.
 castling_rights = {
@@ -241,6 +246,27 @@ function GenerateAttackingMoves(piece, i, j, position)
     return generateMovesCommon(piece, i, j, position, true)
 end
 
+-- the move of piece from (i, j) as {from, to, changes}, the squares it changes
+-- instead of a cloned board
+function playMove(player, piece, i, j, move, position)
+    local changes = {{i, j, 0}}
+    if move.promotion then
+        piece = 6 * (player - 1) + 5
+    end
+    if move.castling then
+        local rook_col = (move.to[2] == 3) and 1 or 8
+        local rook = 6 * (player - 1) + 4
+        changes[#changes + 1] = {i, rook_col, 0}
+        changes[#changes + 1] = {i, (move.to[2] == 3) and 4 or 6, rook}
+    end
+    changes[#changes + 1] = {move.to[1], move.to[2], piece}
+    -- print("Move: ", i, j, move.to[1], move.to[2], piece_names[piece])
+    return {
+        from = {i, j}, to = {move.to[1], move.to[2]}, changes = changes,
+        capture = position.get(move.to[1], move.to[2]), promotion = move.promotion
+    }
+end
+
 function Moves(player, position)
     -- player = player == 1 and 2 or 1
 
@@ -251,20 +277,7 @@ function Moves(player, position)
             if belongsToPlayer(piece, player) then
                 local pieceMoves = GenerateMoves(piece, i, j, position)
                 for _, move in ipairs(pieceMoves) do
-                    local new_board = position.clone()
-                    new_board.set(i, j, 0)
-                    if move.promotion then
-                        piece = 6 * (player - 1) + 5
-                    end
-                    if move.castling then
-                        local rook_col = (move.to[2] == 3) and 1 or 8
-                        local rook = 6 * (player - 1) + 4
-                        new_board.set(i, rook_col, 0)
-                        new_board.set(i, (move.to[2] == 3) and 4 or 6, rook)
-                    end
-                    new_board.set(move.to[1], move.to[2], piece)
-                    -- print("Move: ", i, j, move.to[1], move.to[2], piece_names[piece])
-                    table.insert(out, {from = {i, j}, to = {move.to[1], move.to[2]}, board = new_board})
+                    table.insert(out, playMove(player, piece, i, j, move, position))
                 end
             end
         end
@@ -275,23 +288,87 @@ function Moves(player, position)
     return out
 end
 
-function Type(player, position)
-    local moves = Moves(player, position)
-    local type = nil
-    if #moves == 0 then
-        type = IsInCheck(player, position) and "loss" or "draw"
-        return type
+-- Same moves as Moves, one at a time: captures and promotions first, then the quiet
+-- moves. Moves are only built for those actually asked for, so the engine saves
+-- most of the work at a node that cuts off early.
+function MovesIter(player, position)
+    return coroutine.wrap(function()
+        local quiet = {}
+        for i = 1, BOARD_HEIGHT do
+            for j = 1, BOARD_WIDTH do
+                local piece = position.get(i, j)
+                if belongsToPlayer(piece, player) then
+                    for _, move in ipairs(GenerateMoves(piece, i, j, position)) do
+                        if move.promotion or position.get(move.to[1], move.to[2]) ~= 0 then
+                            coroutine.yield(playMove(player, piece, i, j, move, position))
+                        else
+                            table.insert(quiet, {piece, i, j, move})
+                        end
+                    end
+                end
+            end
+        end
+
+        for _, q in ipairs(quiet) do
+            coroutine.yield(playMove(player, q[1], q[2], q[3], q[4], position))
+        end
+    end)
+end
+
+-- hands the move of piece from (i, j) to emit, a changes table only for castling
+function emitMove(emit, player, piece, i, j, move, position)
+    local capture = position.get(move.to[1], move.to[2])
+    if move.castling then
+        emit(i, j, move.to[1], move.to[2], playMove(player, piece, i, j, move, position).changes, capture, false)
+    elseif move.promotion then
+        emit(i, j, move.to[1], move.to[2], 6 * (player - 1) + 5, capture, true)
+    else
+        emit(i, j, move.to[1], move.to[2], nil, capture, false)
     end
+end
 
-    local moves_opp = Moves(player == 1 and 2 or 1, position)
-    if #moves_opp == 0 then
-        type = IsInCheck(player == 1 and 2 or 1, position) and "win" or "draw"
-        return type
+-- Same moves in the same order as MovesIter, handed to emit instead of returned as
+-- tables. Quiet moves wait in a flat list, 4 entries each.
+function EmitMoves(player, position, emit)
+    local quiet = {}
+    for i = 1, BOARD_HEIGHT do
+        for j = 1, BOARD_WIDTH do
+            local piece = position.get(i, j)
+            if belongsToPlayer(piece, player) then
+                for _, move in ipairs(GenerateMoves(piece, i, j, position)) do
+                    if move.promotion or position.get(move.to[1], move.to[2]) ~= 0 then
+                        emitMove(emit, player, piece, i, j, move, position)
+                    else
+                        local k = #quiet
+                        quiet[k + 1], quiet[k + 2], quiet[k + 3], quiet[k + 4] = piece, i, j, move
+                    end
+                end
+            end
+        end
     end
-    
+
+    for k = 1, #quiet, 4 do
+        emitMove(emit, player, quiet[k], quiet[k + 1], quiet[k + 2], quiet[k + 3], position)
+    end
+end
+
+-- whether player has any legal move, stopping at the first piece that does
+function hasMoves(player, position)
+    for i = 1, BOARD_HEIGHT do
+        for j = 1, BOARD_WIDTH do
+            local piece = position.get(i, j)
+            if belongsToPlayer(piece, player) and #GenerateMoves(piece, i, j, position) > 0 then
+                return true
+            end
+        end
+    end
+
+    return false
+end
+
+-- the non-empty squares, excluding kings
+function pieceCount(position)
     local piece_count = 0
-    
-    -- Count the number of non-empty squares (excluding kings)
     for i = 1, BOARD_WIDTH do
         for j = 1, BOARD_HEIGHT do
             local piece = position.get(i, j)
@@ -301,6 +378,20 @@ function Type(player, position)
         end
     end
 
+    return piece_count
+end
+
+-- Type, with the piece count already known
+function positionType(player, position, piece_count)
+    if not hasMoves(player, position) then
+        return IsInCheck(player, position) and "loss" or "draw"
+    end
+
+    local opp = player == 1 and 2 or 1
+    if not hasMoves(opp, position) then
+        return IsInCheck(opp, position) and "win" or "draw"
+    end
+
     -- If only two kings remain, it's a draw
     if piece_count == 0 then
         return "draw"
@@ -309,6 +400,60 @@ function Type(player, position)
     return nil
 end
 
+function Type(player, position)
+    return positionType(player, position, pieceCount(position))
+end
+
+-- Moves in MovesIter's order, each with the Type of the position it leads to. The
+-- move is played on position in place and undone after, and the piece count is
+-- counted once and adjusted for captures.
+function MovesWithStatus(player, position)
+    local out = {}
+    local quiet = {}
+    local piece_count = pieceCount(position)
+    local opp = player == 1 and 2 or 1
+
+    local function add(piece, i, j, move)
+        local m = playMove(player, piece, i, j, move, position)
+        local old = {}
+        for k, c in ipairs(m.changes) do
+            old[k] = position.get(c[1], c[2])
+            position.set(c[1], c[2], c[3])
+        end
+
+        local captured = m.capture ~= 0 and m.capture ~= 6 and m.capture ~= 12
+        m.status = positionType(opp, position, piece_count - (captured and 1 or 0))
+
+        for k = #m.changes, 1, -1 do
+            local c = m.changes[k]
+            position.set(c[1], c[2], old[k])
+        end
+        out[#out + 1] = m
+    end
+
+    for i = 1, BOARD_HEIGHT do
+        for j = 1, BOARD_WIDTH do
+            local piece = position.get(i, j)
+            if belongsToPlayer(piece, player) then
+                for _, move in ipairs(GenerateMoves(piece, i, j, position)) do
+                    if move.promotion or position.get(move.to[1], move.to[2]) ~= 0 then
+                        add(piece, i, j, move)
+                    else
+                        local k = #quiet
+                        quiet[k + 1], quiet[k + 2], quiet[k + 3], quiet[k + 4] = piece, i, j, move
+                    end
+                end
+            end
+        end
+    end
+
+    for k = 1, #quiet, 4 do
+        add(quiet[k], quiet[k + 1], quiet[k + 2], quiet[k + 3])
+    end
+
+    return out
+end
+
 
 -------------------------------
 -- Initial Board Setup
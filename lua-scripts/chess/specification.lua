@@ -6,7 +6,9 @@ piece_names: table
 
 function Type(player: number, position: board)
     - player: 1 for white, 2 for black.
-    - position: board with get,set,clone
+    - position: board with get,set,clone, called as position.get(i, j) or position:get(i, j)
+    - boards (position and its clones) are reused by the engine once the call returns,
+      don't keep one or add fields to it
     - returns: a string "win", "loss", "draw", or nil if not an ending state
 
 function moves(player: number, position: table): table
@@ -16,8 +18,61 @@ function moves(player: number, position: table): table
         Each move = {
             from = {i:number, j:number},
             to   = {i:number, j:number},
-            board = new board
+            board = new board,
+            -- or instead of board, the squares the move changes, applied in order
+            changes = {{i, j, piece}, ...},
+            -- moves changing up to 12 squares are stored without an allocation
+            -- only read if MOVE_TAGS is true, otherwise the engine works out
+            -- captures and promotions by comparing the boards
+            capture = piece taken (0 or nil if none, true if it doesn't matter),
+            promotion = true if the moving piece changes,
+            check = true if it gives check
         }
+
+function MovesIter(player: number, position: board): function (optional)
+    - same arguments as moves
+    - returns: a function giving the next move (as above) on each call, nil once done.
+      Called from a coroutine.wrap, it lets the engine stop generating at a cutoff.
+      Must give the same moves in the same order every time for a position,
+      when defined it is used for every move list instead of moves.
+
+function MovesWithStatus(player: number, position: board): table (optional)
+    - same as moves, in the same order as the moves the engine gets otherwise
+      (EmitMoves, MovesIter or moves), and each move also has
+        status = Type(other player, position after the move)
+    - the engine then needs one call per position instead of one per child,
+      and the script can share work (e.g. check detection) between the two
+
+function EmitMoves(player: number, position: board, emit: function) (optional)
+    - same first arguments as moves, returns nothing
+    - calls emit(fi, fj, ti, tj, after, capture, promotion, check) once per move instead
+      of building move tables. after is one of:
+        nil: the piece on (fi, fj) moves to (ti, tj)
+        a piece: the same, but it turns into that piece
+        a changes table or a board, as in a move above
+      capture, promotion and check are as in a move above, read if MOVE_TAGS is true.
+    - when defined it is used for full move lists instead of moves and MovesIter,
+      so it must give the same moves in the same order as MovesIter
+
+MOVE_TAGS: boolean (optional)
+    - true if moves carry capture / promotion / check, see moves above
+    - with it, quiescence searches only captures and promotions. Without it,
+      quiescence searches the moves that gain enough by the static evaluation,
+      which suits games like placement games where nothing is ever captured.
+
+NULL_MOVE: boolean (optional)
+    - true lets the search try passing: if the side to move still wins with the
+      opponent moving twice, the node is cut. Only sound when moving is never worse
+      than passing (no zugzwang), leave it unset for placement games.
+      main2 play nullmove=0/1 overrides it.
+
+PROBCUT: boolean (optional)
+    - true lets the search cut on a capture that holds well above the bound at a
+      reduced depth. Needs MOVE_TAGS, and captures that decide the score.
+      main2 play probcut=0/1 overrides it.
+
+The other forward prunings (lmr, futility, rfp) are on for every script,
+main2 play lmr=0, futility=0, rfp=0 switch them off.
 --]]
 
 piece_names = {